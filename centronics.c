@@ -0,0 +1,758 @@
+/*
+ * Centronics parallel port interface
+ */
+
+#include "centronics.h"
+#include "lines.h"
+#include "frame.h"
+#include "timer.h"
+#include <gpio.h>
+#include <afio.h>
+#include <tim.h>
+#include <misc.h>
+#include <string.h>
+#include <stdbool.h>
+
+/** DMA channel registers */
+struct centronics_dma_chan {
+    /* Configuration register */
+    uint32_t ccr;
+    /* Number of data register */
+    uint32_t cndtr;
+    /* Peripheral address register */
+    uint32_t cpar;
+    /* Memory address register */
+    uint32_t cmar;
+};
+
+/** DMA1 channel 2 registers, serving TIM1 channel 1 requests */
+#define CENTRONICS_DMA_CHAN \
+    ((volatile struct centronics_dma_chan *)0x4002001C)
+
+/** CCR channel enable bit */
+#define CENTRONICS_DMA_CCR_EN       (1U << 0)
+/** CCR circular mode bit */
+#define CENTRONICS_DMA_CCR_CIRC     (1U << 5)
+/** CCR memory increment mode bit */
+#define CENTRONICS_DMA_CCR_MINC     (1U << 7)
+/** CCR 16-bit peripheral size */
+#define CENTRONICS_DMA_CCR_PSIZE_16 (1U << 8)
+/** CCR 16-bit memory size */
+#define CENTRONICS_DMA_CCR_MSIZE_16 (1U << 10)
+/** CCR very high channel priority */
+#define CENTRONICS_DMA_CCR_PL_VHIGH (3U << 12)
+
+/** The GPIO port with the data pins */
+#define CENTRONICS_DATA_GPIO    GPIO_B
+
+/** The GPIO port with the STROBE and BUSY pins */
+#define CENTRONICS_CTRL_GPIO    GPIO_A
+/** STROBE pin number */
+#define CENTRONICS_PIN_STROBE   8
+/** BUSY pin number */
+#define CENTRONICS_PIN_BUSY     15
+
+/** The timer capturing STROBE edges on its channel 1 */
+#define CENTRONICS_TIM          TIM1
+
+/**
+ * Input capture filter of the STROBE edges: eight samples at the timer
+ * clock, rejecting glitches shorter than ~110ns at 72MHz
+ */
+#define CENTRONICS_STROBE_FILTER    3
+
+/** Size of the capture ring buffer, samples, a power of two */
+#define CENTRONICS_RING_SIZE    256
+
+/**
+ * Number of free capture ring buffer slots to keep BUSY asserted below,
+ * enough for the bytes the host can send before noticing it
+ */
+#define CENTRONICS_BUSY_MARGIN  64
+
+/** Time the host can stay silent before the job ends, ms */
+#define CENTRONICS_JOB_GAP_MS   500
+
+/** Number of dot lines in a bit image band */
+#define CENTRONICS_BAND_LINES   8
+
+/** Parser state */
+enum centronics_state {
+    /* Receiving text */
+    CENTRONICS_STATE_TEXT,
+    /* Received ESC */
+    CENTRONICS_STATE_ESC,
+    /* Received ESC *, expecting the density */
+    CENTRONICS_STATE_IMAGE_MODE,
+    /* Expecting the low byte of the bit image column count */
+    CENTRONICS_STATE_IMAGE_N1,
+    /* Expecting the high byte of the bit image column count */
+    CENTRONICS_STATE_IMAGE_N2,
+    /* Receiving bit image columns */
+    CENTRONICS_STATE_IMAGE_DATA,
+    /* Receiving command parameter bytes */
+    CENTRONICS_STATE_PARAMS,
+    /* Skipping a number of command data bytes */
+    CENTRONICS_STATE_SKIP,
+    /* Skipping command data bytes up to a NUL */
+    CENTRONICS_STATE_SKIP_NUL,
+};
+
+/** Maximum number of ESC/P command parameter bytes kept */
+#define CENTRONICS_PARAM_MAX    3
+
+/** Flag of ESC/P commands followed by a NUL-terminated list */
+#define CENTRONICS_ESC_NUL_LIST 0x80
+
+/**
+ * Number of parameter bytes of ESC/P commands, indexed by the byte after
+ * ESC, optionally with CENTRONICS_ESC_NUL_LIST, zero for commands taking
+ * none, or handled separately. The data following ESC (, ESC &, ESC ^,
+ * and ESC C NUL is sized by the parameters, see centronics_esc_data_len().
+ */
+static const uint8_t centronics_esc_params[0x80] = {
+    [0x19] = 1, /* EM n, cut sheet feeder control */
+    [' '] = 1,  /* Intercharacter space */
+    ['!'] = 1,  /* Master select */
+    ['$'] = 2,  /* Absolute horizontal position */
+    ['%'] = 1,  /* Select character set */
+    ['&'] = 3,  /* Define user-defined characters */
+    ['('] = 3,  /* Extended commands, length-prefixed */
+    ['+'] = 1,  /* n/360-inch line spacing */
+    ['-'] = 1,  /* Underline */
+    ['/'] = 1,  /* Vertical tab channel */
+    ['3'] = 1,  /* n/216-inch line spacing */
+    [':'] = 3,  /* Copy ROM to RAM */
+    ['?'] = 2,  /* Reassign bit image mode */
+    ['A'] = 1,  /* n/72-inch line spacing */
+    ['B'] = CENTRONICS_ESC_NUL_LIST,  /* Vertical tabs */
+    ['C'] = 1,  /* Page length, in lines, or in inches after NUL */
+    ['D'] = CENTRONICS_ESC_NUL_LIST,  /* Horizontal tabs */
+    ['I'] = 1,  /* Printable control codes */
+    ['J'] = 1,  /* Advance paper n/216 inch */
+    ['N'] = 1,  /* Skip over perforation */
+    ['Q'] = 1,  /* Right margin */
+    ['R'] = 1,  /* International character set */
+    ['S'] = 1,  /* Superscript/subscript */
+    ['U'] = 1,  /* Unidirectional mode */
+    ['W'] = 1,  /* Double width */
+    ['X'] = 3,  /* Select font by pitch and point */
+    ['\\'] = 2, /* Relative horizontal position */
+    ['^'] = 3,  /* Nine-pin graphics */
+    ['a'] = 1,  /* Justification */
+    ['b'] = 1 | CENTRONICS_ESC_NUL_LIST,  /* Vertical tabs in channel */
+    ['c'] = 2,  /* Horizontal motion index */
+    ['e'] = 2,  /* Fixed tab increment */
+    ['f'] = 2,  /* Horizontal/vertical skip */
+    ['h'] = 1,  /* Double or quadruple size */
+    ['i'] = 1,  /* Immediate print */
+    ['j'] = 1,  /* Reverse paper feed */
+    ['k'] = 1,  /* Typeface */
+    ['l'] = 1,  /* Left margin */
+    ['p'] = 1,  /* Proportional mode */
+    ['q'] = 1,  /* Character style */
+    ['r'] = 1,  /* Print color */
+    ['s'] = 1,  /* Half-speed mode */
+    ['t'] = 1,  /* Character table */
+    ['w'] = 1,  /* Double height */
+    ['x'] = 1,  /* Draft or letter quality */
+};
+
+/**
+ * Capture ring buffer, filled with data port samples by DMA, one per
+ * STROBE
+ */
+static volatile uint16_t centronics_ring[CENTRONICS_RING_SIZE];
+
+/*
+ * Written by poll, read by the BUSY timer.
+ */
+/** Index of the next capture ring buffer sample to parse */
+static volatile uint32_t centronics_tail;
+/** True if BUSY is held asserted regardless of the buffer space */
+static volatile bool centronics_held;
+
+/*
+ * Only used by the BUSY timer.
+ */
+/** The capture ring buffer head at the previous tick */
+static uint32_t centronics_head_prev;
+/** The capture ring buffer tail at the previous tick */
+static uint32_t centronics_tail_prev;
+/** Number of unparsed samples at the previous tick */
+static uint32_t centronics_used_prev;
+
+/** The timer updating the BUSY output */
+static struct timer centronics_busy_timer;
+
+/** Number of bytes received */
+volatile uint32_t centronics_byte_count;
+/** Number of times the host overwrote unparsed bytes */
+volatile uint32_t centronics_overrun_count;
+
+/*
+ * Only used by poll.
+ */
+/** Parser state */
+static enum centronics_state centronics_state;
+/** Timer ticks at the last received byte */
+static uint32_t centronics_last_ticks;
+/** The text line being received */
+static uint8_t centronics_text[LINES_LINE_SIZE];
+/** Number of characters in the text line being received */
+static size_t centronics_text_len;
+/** True if the text line is waiting to be input */
+static bool centronics_text_pending;
+/** True if the next line end should be ignored, after a wrap or a band */
+static bool centronics_eol_skip;
+/** True if the last byte was a CR, so a following LF is ignored */
+static bool centronics_cr;
+/** Number of bit image bytes per column, one or three */
+static unsigned int centronics_image_rows;
+/** Number of bit image bytes left to receive, or command data to skip */
+static uint32_t centronics_left;
+/** The byte after ESC of the command receiving parameters */
+static uint8_t centronics_cmd;
+/** The command parameters received */
+static uint8_t centronics_params[CENTRONICS_PARAM_MAX];
+/** Number of command parameters received */
+static size_t centronics_param_num;
+/** Index of the next bit image column to receive */
+static uint32_t centronics_col;
+/** Bit image columns of the current column byte, top pin first */
+static uint8_t centronics_cols[8];
+/** The bit image band being received or input */
+static uint8_t centronics_band[CENTRONICS_BAND_LINES][LINES_LINE_SIZE];
+/** Number of band lines waiting to be input */
+static unsigned int centronics_band_left;
+/** True if the job should end once the waiting lines are input */
+static bool centronics_job_end_pending;
+
+/**
+ * Get the index of the capture ring buffer sample DMA writes next.
+ *
+ * @return The sample index, modulo CENTRONICS_RING_SIZE.
+ */
+static inline uint32_t
+centronics_head(void)
+{
+    return CENTRONICS_RING_SIZE - CENTRONICS_DMA_CHAN->cndtr;
+}
+
+/**
+ * Count an overrun if the samples captured since the previous tick
+ * overwrote unparsed ones, assert BUSY while the capture ring buffer is
+ * almost full, or held, and release it otherwise.
+ *
+ * @param data  Not used.
+ */
+static void
+centronics_busy_update(void *data)
+{
+    uint32_t head = centronics_head();
+    uint32_t tail = centronics_tail;
+    uint32_t used = (head - tail) & (CENTRONICS_RING_SIZE - 1);
+    (void)data;
+
+    /*
+     * Samples left from the previous tick, plus the captured, minus the
+     * parsed, can't reach the buffer size without overwriting. Over a
+     * whole buffer captured between two ticks goes unnoticed.
+     */
+    if (centronics_used_prev +
+        ((head - centronics_head_prev) & (CENTRONICS_RING_SIZE - 1)) -
+        ((tail - centronics_tail_prev) & (CENTRONICS_RING_SIZE - 1)) >=
+            CENTRONICS_RING_SIZE) {
+        centronics_overrun_count++;
+    }
+    centronics_head_prev = head;
+    centronics_tail_prev = tail;
+    centronics_used_prev = used;
+
+    CENTRONICS_CTRL_GPIO->bsrr =
+        centronics_held ||
+        used >= CENTRONICS_RING_SIZE - CENTRONICS_BUSY_MARGIN
+            ? 1U << CENTRONICS_PIN_BUSY
+            : 1U << (CENTRONICS_PIN_BUSY + 16);
+}
+
+/**
+ * Extract the data byte from a data port sample.
+ *
+ * @param sample    The data port sample.
+ *
+ * @return The data byte.
+ */
+static inline uint8_t
+centronics_byte(uint16_t sample)
+{
+    return (sample & 0x03) | ((sample >> 1) & 0x3C) | ((sample >> 4) & 0xC0);
+}
+
+/**
+ * Input a line into the line ring buffer, if owned and not full.
+ *
+ * @param line  The line, LINES_LINE_SIZE bytes.
+ * @param meta  The line's metadata.
+ *
+ * @return True if the line was input, false if it has to wait.
+ */
+static bool
+centronics_line_put(const uint8_t *line, const struct linemeta *meta)
+{
+    volatile uint8_t *slot;
+    size_t i;
+
+    if (!lines_claim(LINES_OWNER_CENTRONICS) || lines_is_full()) {
+        return false;
+    }
+    slot = lines_next();
+    for (i = 0; i < LINES_LINE_SIZE; i++) {
+        slot[i] = line[i];
+    }
+    lines_put(meta);
+    return true;
+}
+
+/**
+ * Input the waiting lines while possible, and end the job once they're
+ * all input, if requested.
+ *
+ * @return True if nothing is waiting, false otherwise.
+ */
+static bool
+centronics_flush(void)
+{
+    struct linemeta meta;
+
+    if (centronics_text_pending) {
+        memset(centronics_text + centronics_text_len, 0,
+               LINES_LINE_SIZE - centronics_text_len);
+        linemeta_compute_text(&meta, centronics_text, centronics_text_len);
+        if (!centronics_line_put(centronics_text, &meta)) {
+            return false;
+        }
+        centronics_text_pending = false;
+        centronics_text_len = 0;
+    }
+    while (centronics_band_left > 0) {
+        const uint8_t *line = centronics_band[CENTRONICS_BAND_LINES -
+                                              centronics_band_left];
+        linemeta_compute(&meta, line, LINES_LINE_SIZE);
+        if (!centronics_line_put(line, &meta)) {
+            return false;
+        }
+        centronics_band_left--;
+    }
+    if (centronics_job_end_pending) {
+        if (lines_owner == LINES_OWNER_CENTRONICS) {
+            lines_job_end();
+            lines_release();
+        }
+        centronics_job_end_pending = false;
+    }
+    return true;
+}
+
+/**
+ * End the text line being received, scheduling it for input.
+ */
+static void
+centronics_text_end(void)
+{
+    centronics_text_pending = true;
+    centronics_eol_skip = false;
+}
+
+/**
+ * Handle a line end: input the text line, even if empty, unless the line
+ * was already ended by a wrap or a bit image band.
+ */
+static void
+centronics_eol(void)
+{
+    if (centronics_eol_skip) {
+        centronics_eol_skip = false;
+    } else {
+        centronics_text_end();
+    }
+}
+
+/**
+ * Add a character to the text line, wrapping it when full.
+ *
+ * @param c The character to add.
+ */
+static void
+centronics_text_add(uint8_t c)
+{
+    centronics_text[centronics_text_len++] = c;
+    centronics_eol_skip = false;
+    if (centronics_text_len >= LINES_LINE_SIZE) {
+        centronics_text_end();
+        centronics_eol_skip = true;
+    }
+}
+
+/**
+ * Schedule the end of the job, after the text received so far.
+ */
+static void
+centronics_job_end(void)
+{
+    if (centronics_text_len > 0) {
+        centronics_text_end();
+    }
+    centronics_job_end_pending = true;
+    centronics_eol_skip = false;
+}
+
+/**
+ * Reset the parser to its initial state, dropping the text line being
+ * received.
+ */
+static void
+centronics_reset(void)
+{
+    centronics_state = CENTRONICS_STATE_TEXT;
+    centronics_text_len = 0;
+    centronics_eol_skip = false;
+    centronics_cr = false;
+}
+
+/**
+ * Start receiving a bit image, once the column count is known, inputting
+ * the text line received before it first.
+ */
+static void
+centronics_image_start(void)
+{
+    if (centronics_text_len > 0) {
+        centronics_text_end();
+    }
+    memset(centronics_band, 0, sizeof(centronics_band));
+    memset(centronics_cols, 0, sizeof(centronics_cols));
+    centronics_col = 0;
+    centronics_left *= centronics_image_rows;
+    centronics_state = centronics_left > 0 ? CENTRONICS_STATE_IMAGE_DATA
+                                           : CENTRONICS_STATE_TEXT;
+}
+
+/**
+ * Transpose the collected bit image columns into the band, if within the
+ * line.
+ */
+static void
+centronics_image_cols_flush(void)
+{
+    size_t byte = (centronics_col - 1) / 8;
+
+    if (byte < LINES_LINE_SIZE) {
+        frame_transpose8(&centronics_band[0][byte], LINES_LINE_SIZE,
+                         centronics_cols, 1);
+    }
+    memset(centronics_cols, 0, sizeof(centronics_cols));
+}
+
+/**
+ * Accept the next bit image byte, inputting the band once complete.
+ *
+ * @param byte  The received byte.
+ */
+static void
+centronics_image_add(uint8_t byte)
+{
+    /* 24-pin images are skipped, only their columns are counted */
+    if (centronics_image_rows == 1) {
+        centronics_cols[centronics_col % 8] = byte;
+        centronics_col++;
+        if (centronics_col % 8 == 0) {
+            centronics_image_cols_flush();
+        }
+    }
+    if (--centronics_left == 0) {
+        if (centronics_image_rows == 1) {
+            if (centronics_col % 8 != 0) {
+                centronics_image_cols_flush();
+            }
+            centronics_band_left = CENTRONICS_BAND_LINES;
+            centronics_eol_skip = true;
+        }
+        centronics_state = CENTRONICS_STATE_TEXT;
+    }
+}
+
+/**
+ * Get the number of data bytes following the parameters of the command
+ * being received.
+ *
+ * @return The number of data bytes.
+ */
+static uint32_t
+centronics_esc_data_len(void)
+{
+    const uint8_t *p = centronics_params;
+
+    switch (centronics_cmd) {
+    case '(':
+        /* ESC ( c nL nH */
+        return p[1] | ((uint32_t)p[2] << 8);
+    case '&':
+        /* ESC & NUL n m, an attribute and 11 bytes per character */
+        return p[2] >= p[1] ? (uint32_t)(p[2] - p[1] + 1) * 12 : 0;
+    case '^':
+        /* ESC ^ m nL nH, two bytes per column */
+        return (p[1] | ((uint32_t)p[2] << 8)) * 2;
+    case 'C':
+        /* ESC C NUL n */
+        return p[0] == 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Skip the data following the command parameters received, if any.
+ */
+static void
+centronics_esc_params_end(void)
+{
+    if (centronics_esc_params[centronics_cmd] & CENTRONICS_ESC_NUL_LIST) {
+        centronics_state = CENTRONICS_STATE_SKIP_NUL;
+    } else {
+        centronics_left = centronics_esc_data_len();
+        centronics_state = centronics_left > 0 ? CENTRONICS_STATE_SKIP
+                                               : CENTRONICS_STATE_TEXT;
+    }
+}
+
+/**
+ * Parse a received byte.
+ *
+ * @param byte  The received byte.
+ */
+static void
+centronics_parse(uint8_t byte)
+{
+    bool cr = centronics_cr;
+
+    centronics_cr = false;
+    switch (centronics_state) {
+    case CENTRONICS_STATE_TEXT:
+        if (byte == 0x1B) {
+            centronics_state = CENTRONICS_STATE_ESC;
+        } else if (byte == '\r') {
+            centronics_eol();
+            centronics_cr = true;
+        } else if (byte == '\n') {
+            /* Take CR LF as a single line end */
+            if (!cr) {
+                centronics_eol();
+            }
+        } else if (byte == '\f') {
+            centronics_job_end();
+        } else if (byte == '\t') {
+            do {
+                centronics_text_add(' ');
+            } while (centronics_text_len % 8 != 0);
+        } else if (byte >= 0x80) {
+            centronics_text_add('?');
+        } else if (byte >= ' ' && byte < 0x7F) {
+            centronics_text_add(byte);
+        }
+        break;
+    case CENTRONICS_STATE_ESC:
+        centronics_state = CENTRONICS_STATE_TEXT;
+        if (byte == '@') {
+            centronics_reset();
+        } else if (byte == 'K' || byte == 'L' || byte == 'Y' ||
+                   byte == 'Z') {
+            centronics_image_rows = 1;
+            centronics_state = CENTRONICS_STATE_IMAGE_N1;
+        } else if (byte == '*') {
+            centronics_state = CENTRONICS_STATE_IMAGE_MODE;
+        } else if (byte < ARRAY_SIZE(centronics_esc_params) &&
+                   centronics_esc_params[byte] != 0) {
+            centronics_cmd = byte;
+            centronics_param_num = 0;
+            if ((centronics_esc_params[byte] &
+                 ~CENTRONICS_ESC_NUL_LIST) == 0) {
+                centronics_esc_params_end();
+            } else {
+                centronics_state = CENTRONICS_STATE_PARAMS;
+            }
+        }
+        break;
+    case CENTRONICS_STATE_PARAMS:
+        if (centronics_param_num < CENTRONICS_PARAM_MAX) {
+            centronics_params[centronics_param_num] = byte;
+        }
+        if (++centronics_param_num ==
+            (centronics_esc_params[centronics_cmd] &
+             ~CENTRONICS_ESC_NUL_LIST)) {
+            centronics_esc_params_end();
+        }
+        break;
+    case CENTRONICS_STATE_IMAGE_MODE:
+        /* Densities from 32 up are 24-pin */
+        centronics_image_rows = byte < 32 ? 1 : 3;
+        centronics_state = CENTRONICS_STATE_IMAGE_N1;
+        break;
+    case CENTRONICS_STATE_IMAGE_N1:
+        centronics_left = byte;
+        centronics_state = CENTRONICS_STATE_IMAGE_N2;
+        break;
+    case CENTRONICS_STATE_IMAGE_N2:
+        centronics_left |= (uint32_t)byte << 8;
+        centronics_image_start();
+        break;
+    case CENTRONICS_STATE_IMAGE_DATA:
+        centronics_image_add(byte);
+        break;
+    case CENTRONICS_STATE_SKIP:
+        if (--centronics_left == 0) {
+            centronics_state = CENTRONICS_STATE_TEXT;
+        }
+        break;
+    case CENTRONICS_STATE_SKIP_NUL:
+        if (byte == 0) {
+            centronics_state = CENTRONICS_STATE_TEXT;
+        }
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+void
+centronics_init(void)
+{
+    static const unsigned int data_pins[] = {0, 1, 3, 4, 5, 6, 10, 11};
+    unsigned int i;
+
+    assert(lines_buf != NULL);
+
+    /*
+     * Initialize the variables
+     */
+    centronics_tail = 0;
+    centronics_held = false;
+    centronics_head_prev = 0;
+    centronics_tail_prev = 0;
+    centronics_used_prev = 0;
+    centronics_byte_count = 0;
+    centronics_overrun_count = 0;
+    centronics_reset();
+    centronics_text_pending = false;
+    centronics_band_left = 0;
+    centronics_job_end_pending = false;
+    centronics_last_ticks = timer_ticks;
+
+    /*
+     * Setup the I/O pins
+     */
+    /* Free PB3, PB4, and PA15 from JTAG, keeping SWD */
+    AFIO->mapr = (AFIO->mapr & ~AFIO_MAPR_SWJ_CFG_MASK) |
+                 (AFIO_MAPR_SWJ_CFG_VAL_JTAG_OFF << AFIO_MAPR_SWJ_CFG_LSB);
+    for (i = 0; i < ARRAY_SIZE(data_pins); i++) {
+        gpio_pin_conf(CENTRONICS_DATA_GPIO, data_pins[i],
+                      GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOATING);
+    }
+    /* Pull STROBE up, not to capture noise when disconnected */
+    gpio_pin_set(CENTRONICS_CTRL_GPIO, CENTRONICS_PIN_STROBE, 1);
+    gpio_pin_conf(CENTRONICS_CTRL_GPIO, CENTRONICS_PIN_STROBE,
+                  GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    /* Start busy, until the capture is running */
+    gpio_pin_set(CENTRONICS_CTRL_GPIO, CENTRONICS_PIN_BUSY, 1);
+    gpio_pin_conf(CENTRONICS_CTRL_GPIO, CENTRONICS_PIN_BUSY,
+                  GPIO_MODE_OUTPUT_2MHZ, GPIO_CNF_OUTPUT_GP_PUSH_PULL);
+
+    /*
+     * Setup the DMA channel copying a data port sample to the capture
+     * ring buffer on each STROBE capture, circularly
+     */
+    CENTRONICS_DMA_CHAN->ccr = 0;
+    CENTRONICS_DMA_CHAN->cpar = (uint32_t)(uintptr_t)
+                                &CENTRONICS_DATA_GPIO->idr;
+    CENTRONICS_DMA_CHAN->cmar = (uint32_t)(uintptr_t)centronics_ring;
+    CENTRONICS_DMA_CHAN->cndtr = CENTRONICS_RING_SIZE;
+    CENTRONICS_DMA_CHAN->ccr = CENTRONICS_DMA_CCR_CIRC |
+                               CENTRONICS_DMA_CCR_MINC |
+                               CENTRONICS_DMA_CCR_PSIZE_16 |
+                               CENTRONICS_DMA_CCR_MSIZE_16 |
+                               CENTRONICS_DMA_CCR_PL_VHIGH |
+                               CENTRONICS_DMA_CCR_EN;
+
+    /*
+     * Setup the timer capturing STROBE falling edges on channel 1
+     */
+    CENTRONICS_TIM->psc = 0;
+    CENTRONICS_TIM->arr = 0xFFFF;
+    CENTRONICS_TIM->ccmr1 = (CENTRONICS_TIM->ccmr1 &
+                             ~(TIM_CCMR1_CC1S_MASK | TIM_CCMR1_IC1F_MASK)) |
+                            (TIM_CCMR1_CC1S_VAL_TI1 << TIM_CCMR1_CC1S_LSB) |
+                            (CENTRONICS_STROBE_FILTER <<
+                             TIM_CCMR1_IC1F_LSB);
+    CENTRONICS_TIM->ccer |= TIM_CCER_CC1P_MASK | TIM_CCER_CC1E_MASK;
+    /* Request DMA on each capture */
+    CENTRONICS_TIM->dier |= TIM_DIER_CC1DE_MASK;
+    /* Transfer the settings and start counting */
+    CENTRONICS_TIM->egr |= TIM_EGR_UG_MASK;
+    CENTRONICS_TIM->cr1 |= TIM_CR1_CEN_MASK;
+
+    /* Update BUSY on every tick */
+    timer_setup(&centronics_busy_timer, centronics_busy_update, NULL);
+    timer_start(&centronics_busy_timer, 0, 1);
+}
+
+void
+centronics_poll(void)
+{
+    uint32_t head = centronics_head();
+    uint32_t tail = centronics_tail;
+
+    /* Parse bytes while the lines they produce can be input */
+    while (centronics_flush() && tail != head) {
+        centronics_parse(centronics_byte(centronics_ring[tail]));
+        centronics_tail = tail = (tail + 1) & (CENTRONICS_RING_SIZE - 1);
+        centronics_byte_count++;
+        centronics_last_ticks = timer_ticks;
+    }
+
+    /* End the job, if the host went silent in the middle of one */
+    if (tail == head && !centronics_job_end_pending &&
+        (centronics_text_len > 0 ||
+         centronics_state != CENTRONICS_STATE_TEXT ||
+         lines_owner == LINES_OWNER_CENTRONICS) &&
+        timer_ticks - centronics_last_ticks >=
+            TIMER_MS(CENTRONICS_JOB_GAP_MS)) {
+        centronics_state = CENTRONICS_STATE_TEXT;
+        centronics_job_end();
+        centronics_flush();
+    }
+}
+
+bool
+centronics_hold(void)
+{
+    /* Assert BUSY first, so nothing is received after the check */
+    centronics_held = true;
+    CENTRONICS_CTRL_GPIO->bsrr = 1U << CENTRONICS_PIN_BUSY;
+    if (centronics_head() == centronics_tail &&
+        centronics_state == CENTRONICS_STATE_TEXT &&
+        centronics_text_len == 0 && !centronics_text_pending &&
+        centronics_band_left == 0 && !centronics_job_end_pending &&
+        lines_owner != LINES_OWNER_CENTRONICS) {
+        return true;
+    }
+    centronics_release();
+    return false;
+}
+
+void
+centronics_release(void)
+{
+    /* Let the BUSY timer release it */
+    centronics_held = false;
+}
@@ -0,0 +1,67 @@
+/*
+ * Centronics parallel port interface
+ */
+
+#ifndef _CENTRONICS_H
+#define _CENTRONICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Pin assignment, fixed by the capture hardware:
+ *
+ * D0-D1    PB0-PB1
+ * D2-D5    PB3-PB6
+ * D6-D7    PB10-PB11
+ * STROBE   PA8, TIM1 channel 1, captured on the falling edge
+ * BUSY     PA15, driven high when the host must hold off
+ */
+
+/** Number of bytes received */
+extern volatile uint32_t centronics_byte_count;
+
+/**
+ * Number of times the host sent bytes over unparsed ones, ignoring BUSY,
+ * or while BUSY updates were stalled
+ */
+extern volatile uint32_t centronics_overrun_count;
+
+/**
+ * Initialize the Centronics interface. Takes over the JTAG pins, leaving
+ * SWD, and uses TIM1 and DMA1 channel 2 to capture the data bytes on
+ * STROBE, without interrupts. Requires the clocks to GPIO ports A and B,
+ * AFIO, TIM1 and DMA1 enabled, and the timer and line ring buffer modules
+ * initialized. TIM1 must be reset.
+ *
+ * Received text is input as text lines of up to LINES_LINE_SIZE
+ * characters, to print with the printer's font, and ESC/P 8-pin bit
+ * images (ESC K, L, Y, Z, and ESC *) - as bands of eight dot lines,
+ * cropped to LINES_LINE_LEN dots. A job ends with a form feed, or when
+ * the host stops sending for a while.
+ */
+extern void centronics_init(void);
+
+/**
+ * Parse the received bytes and input the resulting lines into the line
+ * ring buffer, while it's not full, and not owned by the other input.
+ * Never blocks.
+ */
+extern void centronics_poll(void);
+
+/**
+ * Hold the host off with BUSY, if nothing is received or being parsed,
+ * e.g. to stall the core without losing bytes. Must be called from the
+ * same context as centronics_poll().
+ *
+ * @return True if the host is held off, false if receiving.
+ */
+extern bool centronics_hold(void);
+
+/**
+ * Stop holding the host off, letting BUSY follow the buffer space again
+ * on the next tick.
+ */
+extern void centronics_release(void);
+
+#endif /* _CENTRONICS_H */
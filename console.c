@@ -0,0 +1,622 @@
+/*
+ * Line-based tuning and monitoring console on a serial port
+ */
+
+#include "console.h"
+#include "tune.h"
+#include "output.h"
+#include "printer.h"
+#include "zxprinter.h"
+#include "centronics.h"
+#include "load.h"
+#include "lines.h"
+#include "history.h"
+#include "latency.h"
+#include "irq.h"
+#include "timer.h"
+#include <misc.h>
+#include <string.h>
+#include <stdbool.h>
+
+/** Size of the transmit ring buffer, a power of two */
+#define CONSOLE_TX_BUF_SIZE 512
+
+/** Size of the receive ring buffer, a power of two */
+#define CONSOLE_RX_BUF_SIZE 32
+
+/** Maximum length of a command line */
+#define CONSOLE_LINE_MAX    48
+
+/** Maximum number of words in a command line */
+#define CONSOLE_ARG_MAX     4
+
+/** The USART the console talks over */
+static volatile struct usart *console_usart = NULL;
+
+/** Transmit ring buffer */
+static uint8_t console_tx_buf[CONSOLE_TX_BUF_SIZE];
+
+/** Number of bytes written to the transmit buffer, updated by writer */
+static volatile uint32_t console_tx_head;
+
+/** Number of bytes sent from the transmit buffer, updated by handler */
+static volatile uint32_t console_tx_tail;
+
+/** Receive ring buffer */
+static uint8_t console_rx_buf[CONSOLE_RX_BUF_SIZE];
+
+/** Number of bytes received into the receive buffer, updated by handler */
+static volatile uint32_t console_rx_head;
+
+/** Number of bytes read from the receive buffer, updated by reader */
+static volatile uint32_t console_rx_tail;
+
+/** The command line being received, zero-terminated */
+static char console_line[CONSOLE_LINE_MAX + 1];
+
+/** Length of the command line being received */
+static size_t console_line_len;
+
+/** True if the last character received was a CR */
+static bool console_line_cr;
+
+/** Number of load runs reported */
+static uint32_t console_load_run_count;
+
+/** A console command */
+struct console_cmd {
+    /* Command name */
+    const char *name;
+    /* Argument synopsis and description */
+    const char *usage;
+    /*
+     * Execute the command.
+     *
+     * @param argc  Number of arguments, excluding the command name.
+     * @param argv  The arguments.
+     */
+    void (*fn)(size_t argc, char **argv);
+};
+
+void
+console_usart_handler(void)
+{
+    uint32_t sr;
+
+    assert(console_usart != NULL);
+
+    sr = console_usart->sr;
+
+    /* If a byte was received (reading it clears an overrun too) */
+    if (sr & (USART_SR_RXNE_MASK | USART_SR_ORE_MASK)) {
+        uint8_t byte = console_usart->dr;
+        uint32_t head = console_rx_head;
+        /* Drop it if the buffer is full */
+        if (head - console_rx_tail < CONSOLE_RX_BUF_SIZE) {
+            console_rx_buf[head & (CONSOLE_RX_BUF_SIZE - 1)] = byte;
+            console_rx_head = head + 1;
+        }
+    }
+
+    /* If the transmit data register is empty and we're transmitting */
+    if ((sr & USART_SR_TXE_MASK) &&
+        (console_usart->cr1 & USART_CR1_TXEIE_MASK)) {
+        uint32_t tail = console_tx_tail;
+        if (tail != console_tx_head) {
+            console_usart->dr =
+                console_tx_buf[tail & (CONSOLE_TX_BUF_SIZE - 1)];
+            console_tx_tail = ++tail;
+        }
+        /* If we're out of data */
+        if (tail == console_tx_head) {
+            /* Stop the interrupt */
+            console_usart->cr1 &= ~USART_CR1_TXEIE_MASK;
+        }
+    }
+}
+
+/**
+ * Output a character to the console, waiting for space in the transmit
+ * buffer, if necessary.
+ *
+ * @param c The character to output.
+ */
+static void
+console_putc(char c)
+{
+    uint32_t head = console_tx_head;
+    uint32_t basepri;
+
+    while (head - console_tx_tail >= CONSOLE_TX_BUF_SIZE) {
+        asm ("wfi");
+    }
+    console_tx_buf[head & (CONSOLE_TX_BUF_SIZE - 1)] = c;
+    console_tx_head = head + 1;
+
+    /* Start sending, unless already sending */
+    basepri = irq_lock();
+    console_usart->cr1 |= USART_CR1_TXEIE_MASK;
+    irq_unlock(basepri);
+}
+
+void
+console_write(const char *str)
+{
+    while (*str != '\0') {
+        console_putc(*str++);
+    }
+}
+
+void
+console_write_uint(uint32_t value)
+{
+    char buf[11];
+    char *p = buf + sizeof(buf);
+
+    *--p = '\0';
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    console_write(p);
+}
+
+/**
+ * Output a named value on a line of its own.
+ *
+ * @param name  The value name.
+ * @param value The value.
+ */
+static void
+console_write_value(const char *name, uint32_t value)
+{
+    console_write(name);
+    console_putc(' ');
+    console_write_uint(value);
+    console_write("\r\n");
+}
+
+/**
+ * Parse an unsigned number, decimal, or hexadecimal with the "0x" prefix.
+ *
+ * @param str       The string to parse.
+ * @param pvalue    Location for the parsed value.
+ *
+ * @return True if parsed, false if the string is not a valid number.
+ */
+static bool
+console_parse_uint(const char *str, uint32_t *pvalue)
+{
+    uint32_t base = 10;
+    uint64_t value = 0;
+    uint32_t digit;
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    }
+    if (*str == '\0') {
+        return false;
+    }
+    for (; *str != '\0'; str++) {
+        if (*str >= '0' && *str <= '9') {
+            digit = *str - '0';
+        } else if (*str >= 'a' && *str <= 'f') {
+            digit = *str - 'a' + 10;
+        } else if (*str >= 'A' && *str <= 'F') {
+            digit = *str - 'A' + 10;
+        } else {
+            return false;
+        }
+        if (digit >= base) {
+            return false;
+        }
+        value = value * base + digit;
+        if (value > UINT32_MAX) {
+            return false;
+        }
+    }
+    *pvalue = value;
+    return true;
+}
+
+static void console_cmd_help(size_t argc, char **argv);
+
+/**
+ * Show the tunable parameters and the counters.
+ */
+static void
+console_cmd_show(size_t argc, char **argv)
+{
+    const struct conv_glyph_stats *glyph_stats =
+        output_printer_glyph_stats();
+    enum tune_id id;
+
+    (void)argc;
+    (void)argv;
+
+    for (id = 0; id < TUNE_NUM; id++) {
+        console_write(tune_params[id].name);
+        console_putc(' ');
+        console_write_uint(tune_get(id));
+        console_write(" (");
+        console_write_uint(tune_params[id].min);
+        console_putc('-');
+        console_write_uint(tune_params[id].max);
+        console_write(")\r\n");
+    }
+    console_write_value("lines_in", lines_count_in);
+    console_write_value("jobs", lines_job_count);
+    console_write_value("stalls", zxprinter_stall_count);
+    console_write_value("parallel_bytes", centronics_byte_count);
+    console_write_value("parallel_overruns", centronics_overrun_count);
+    console_write_value("lines_printed", printer_line_count);
+    console_write_value("lines_fed", printer_feed_count);
+    console_write_value("busy_ms", printer_busy_total / TIMER_MS(1));
+    console_write_value("usb_dropped", output_usbcdc.dropped);
+    console_write_value("latency_max", latency_max);
+    console_write_value("latency_count", latency_count);
+    console_write_value("conv_cycles_max", output_printer_conv_cycles_max);
+    console_write_value("glyph_bands", glyph_stats->bands);
+    console_write_value("glyph_raster_bands", glyph_stats->raster_bands);
+    console_write_value("glyph_hits", glyph_stats->hits);
+    console_write_value("glyph_uploads", glyph_stats->uploads);
+    console_write_value("glyph_hit_pct",
+                        glyph_stats->hits == 0 ? 0 :
+                            (uint64_t)glyph_stats->hits * 100 /
+                            (glyph_stats->hits + glyph_stats->uploads));
+    console_write_value("glyph_bytes_saved", glyph_stats->saved);
+    console_write_value("history_jobs", history_job_num());
+    console_write_value("history_used", history_used());
+}
+
+/**
+ * Set a tunable parameter.
+ */
+static void
+console_cmd_set(size_t argc, char **argv)
+{
+    enum tune_id id;
+    uint32_t value;
+
+    if (argc != 2) {
+        console_write("Expecting a name and a value\r\n");
+        return;
+    }
+    id = tune_find(argv[0]);
+    if (id == TUNE_NUM) {
+        console_write("Unknown parameter\r\n");
+    } else if (!console_parse_uint(argv[1], &value)) {
+        console_write("Invalid number\r\n");
+    } else if (!tune_set(id, value)) {
+        console_write("Out of range\r\n");
+    }
+}
+
+/**
+ * Save the tunable parameters to flash.
+ */
+static void
+console_cmd_save(size_t argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    if (lines_owner != LINES_OWNER_NONE || !centronics_hold()) {
+        console_write("Busy receiving a job\r\n");
+    } else {
+        centronics_release();
+        console_write(tune_save() ? "Saved\r\n" : "Failed to save\r\n");
+    }
+}
+
+/**
+ * Reset the tunable parameters to the defaults.
+ */
+static void
+console_cmd_defaults(size_t argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    tune_reset();
+}
+
+/**
+ * Reset the maximum counters.
+ */
+static void
+console_cmd_clear(size_t argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    latency_reset();
+    output_printer_conv_cycles_max = 0;
+}
+
+/**
+ * Reprint a job from the history.
+ */
+static void
+console_cmd_reprint(size_t argc, char **argv)
+{
+    uint32_t num = 1;
+
+    if (argc > 1 || (argc == 1 && !console_parse_uint(argv[0], &num)) ||
+        num == 0) {
+        console_write("Expecting a job number, 1 for the most recent\r\n");
+    } else if (!output_printer_reprint(num - 1)) {
+        console_write("Printing, or no such job\r\n");
+    }
+}
+
+/**
+ * Output the results of the last load run.
+ */
+static void
+console_load_report(void)
+{
+    const struct load_report *report = &load_report;
+    uint32_t ticks = report->ticks != 0 ? report->ticks : 1;
+
+    console_write("load_pattern ");
+    console_write(load_pattern_names[report->pattern]);
+    console_write("\r\n");
+    console_write_value("load_rate", report->rate);
+    console_write_value("load_lines", report->lines);
+    console_write_value("load_ms", report->ticks / TIMER_MS(1));
+    console_write_value("load_lines_per_s",
+                        (uint64_t)report->lines * TIMER_HZ / ticks);
+    console_write_value("load_busy_pct",
+                        (uint64_t)report->busy_ticks * 100 / ticks);
+    /* Ten bits per byte, with the start and stop bits */
+    console_write_value("load_serial_pct",
+                        (uint64_t)report->tx_bytes * 10 * TIMER_HZ * 100 /
+                        ((uint64_t)report->baud * ticks));
+    console_write_value("load_tx_bytes", report->tx_bytes);
+    console_write_value("load_queue_max", report->queue_max);
+    console_write_value("load_stalls", report->stalls);
+}
+
+/**
+ * Start, stop, or report a load run.
+ */
+static void
+console_cmd_load(size_t argc, char **argv)
+{
+    enum load_pattern pattern;
+    uint32_t rate = 0;
+    uint32_t lines = LOAD_LINES_DEFAULT;
+
+    if (argc == 0) {
+        if (load_is_running()) {
+            console_write("Running\r\n");
+        } else if (load_run_count == 0) {
+            console_write("No runs finished\r\n");
+        } else {
+            console_load_report();
+        }
+        return;
+    }
+    if (argc == 1 && strcmp(argv[0], "stop") == 0) {
+        load_stop();
+        return;
+    }
+    pattern = load_pattern_find(argv[0]);
+    if (pattern == LOAD_PATTERN_NUM) {
+        console_write("Unknown pattern, expecting");
+        for (pattern = 0; pattern < LOAD_PATTERN_NUM; pattern++) {
+            console_putc(' ');
+            console_write(load_pattern_names[pattern]);
+        }
+        console_write("\r\n");
+    } else if (argc > 3 ||
+               (argc > 1 && !console_parse_uint(argv[1], &rate)) ||
+               (argc > 2 && !console_parse_uint(argv[2], &lines))) {
+        console_write("Invalid number\r\n");
+    } else if (rate > LOAD_RATE_MAX || lines == 0) {
+        console_write("Out of range\r\n");
+    } else if (!output_printer.enabled) {
+        console_write("Printer output disabled\r\n");
+    } else if (!load_start(pattern, rate, lines)) {
+        console_write("Already running\r\n");
+    }
+}
+
+/** A backend selectable with the "output" command */
+struct console_output {
+    /* Name used in the command */
+    const char *name;
+    /* The backend */
+    struct output *output;
+};
+
+/** The backends selectable with the "output" command */
+static const struct console_output console_outputs[] = {
+    {"printer", &output_printer},
+    {"history", &output_history},
+    {"usb", &output_usbcdc},
+};
+
+/**
+ * Enable or disable an output backend, or list their states.
+ */
+static void
+console_cmd_output(size_t argc, char **argv)
+{
+    size_t i;
+
+    if (argc == 0) {
+        for (i = 0; i < ARRAY_SIZE(console_outputs); i++) {
+            console_write(console_outputs[i].name);
+            console_write(console_outputs[i].output->enabled ?
+                          " on\r\n" : " off\r\n");
+        }
+        return;
+    }
+    for (i = 0; i < ARRAY_SIZE(console_outputs) &&
+                strcmp(console_outputs[i].name, argv[0]) != 0;
+         i++);
+    if (argc != 2 || i == ARRAY_SIZE(console_outputs) ||
+        (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        console_write("Expecting printer, history, or usb, "
+                      "and on or off\r\n");
+    } else if (load_is_running()) {
+        console_write("Load running\r\n");
+    } else {
+        output_set_enabled(console_outputs[i].output,
+                           strcmp(argv[1], "on") == 0);
+    }
+}
+
+/**
+ * Select the format of the lines streamed over USB.
+ */
+static void
+console_cmd_usbfmt(size_t argc, char **argv)
+{
+    if (argc == 1 && strcmp(argv[0], "pbm") == 0) {
+        output_usbcdc_set_format(OUTPUT_FORMAT_PBM);
+    } else if (argc == 1 && strcmp(argv[0], "raw") == 0) {
+        output_usbcdc_set_format(OUTPUT_FORMAT_RAW);
+    } else {
+        console_write("Expecting pbm or raw\r\n");
+    }
+}
+
+/** The console commands */
+static const struct console_cmd console_cmds[] = {
+    {"help", "- list commands", console_cmd_help},
+    {"show", "- show parameters and counters", console_cmd_show},
+    {"set", "NAME VALUE - set a parameter", console_cmd_set},
+    {"save", "- save parameters for the next boot", console_cmd_save},
+    {"defaults", "- reset parameters to defaults", console_cmd_defaults},
+    {"clear", "- reset maximum counters", console_cmd_clear},
+    {"reprint", "[NUM] - reprint a job, 1 for the most recent",
+     console_cmd_reprint},
+    {"load", "[PATTERN [RATE [LINES]]|stop] - run synthetic load, "
+             "or show results", console_cmd_load},
+    {"output", "[printer|history|usb on|off] - enable or disable "
+               "an output, or list them", console_cmd_output},
+    {"usbfmt", "pbm|raw - select the USB line format", console_cmd_usbfmt},
+};
+
+/**
+ * List the commands.
+ */
+static void
+console_cmd_help(size_t argc, char **argv)
+{
+    size_t i;
+
+    (void)argc;
+    (void)argv;
+
+    for (i = 0; i < ARRAY_SIZE(console_cmds); i++) {
+        console_write(console_cmds[i].name);
+        console_putc(' ');
+        console_write(console_cmds[i].usage);
+        console_write("\r\n");
+    }
+}
+
+/**
+ * Split the received command line into words and execute the command.
+ */
+static void
+console_execute(void)
+{
+    char *argv[CONSOLE_ARG_MAX];
+    size_t argc = 0;
+    char *p = console_line;
+    size_t i;
+
+    /* Split the line on spaces, in place */
+    while (true) {
+        while (*p == ' ') {
+            *p++ = '\0';
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (argc == CONSOLE_ARG_MAX) {
+            console_write("Too many words\r\n");
+            return;
+        }
+        argv[argc++] = p;
+        while (*p != ' ' && *p != '\0') {
+            p++;
+        }
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(console_cmds); i++) {
+        if (strcmp(console_cmds[i].name, argv[0]) == 0) {
+            console_cmds[i].fn(argc - 1, argv + 1);
+            return;
+        }
+    }
+    console_write("Unknown command, try \"help\"\r\n");
+}
+
+void
+console_init(volatile struct usart *usart)
+{
+    assert(console_usart == NULL);
+    console_usart = usart;
+    console_tx_head = console_tx_tail = 0;
+    console_rx_head = console_rx_tail = 0;
+    console_line_len = 0;
+    console_line_cr = false;
+    console_load_run_count = load_run_count;
+    /* Enable the receiver and its interrupt */
+    console_usart->cr1 |= USART_CR1_RE_MASK | USART_CR1_RXNEIE_MASK;
+    console_write("\r\n> ");
+}
+
+void
+console_poll(void)
+{
+    uint32_t tail = console_rx_tail;
+    size_t i;
+    char c;
+
+    /* Report the load runs finished since the last check */
+    if (console_load_run_count != load_run_count) {
+        console_load_run_count = load_run_count;
+        console_write("\r\n");
+        console_load_report();
+        console_write("> ");
+        /* Bring back the command line being typed */
+        for (i = 0; i < console_line_len; i++) {
+            console_putc(console_line[i]);
+        }
+    }
+
+    while (tail != console_rx_head) {
+        c = console_rx_buf[tail & (CONSOLE_RX_BUF_SIZE - 1)];
+        console_rx_tail = ++tail;
+        /* Take CR LF as a single line end */
+        if (c == '\n' && console_line_cr) {
+            console_line_cr = false;
+            continue;
+        }
+        console_line_cr = c == '\r';
+        if (c == '\r' || c == '\n') {
+            console_write("\r\n");
+            console_line[console_line_len] = '\0';
+            console_execute();
+            console_line_len = 0;
+            console_write("> ");
+        } else if (c == '\b' || c == 0x7F) {
+            if (console_line_len > 0) {
+                console_line_len--;
+                console_write("\b \b");
+            }
+        } else if (c >= ' ' && c < 0x7F &&
+                   console_line_len < CONSOLE_LINE_MAX) {
+            console_line[console_line_len++] = c;
+            console_putc(c);
+        }
+    }
+}
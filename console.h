@@ -0,0 +1,53 @@
+/*
+ * Line-based tuning and monitoring console on a serial port
+ */
+
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include <usart.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Initialize the console and print the prompt.
+ *
+ * @param usart The USART to talk over. Must have line parameters
+ *              configured, and its transmitter enabled. The
+ *              console_usart_handler() function should be arranged to be
+ *              called for the USART's interrupts, at the
+ *              IRQ_PRIO_HOUSEKEEPING priority.
+ */
+extern void console_init(volatile struct usart *usart);
+
+/**
+ * Console's USART interrupt handler.
+ *
+ * Must be called when an interrupt is triggered for the USART passed
+ * previously to console_init().
+ */
+extern void console_usart_handler(void);
+
+/**
+ * Echo the received characters, and execute the command, once a line is
+ * complete. Must be called from the main loop. Can wait for the
+ * transmission of the command's output, if it's long.
+ */
+extern void console_poll(void);
+
+/**
+ * Output a string to the console, waiting for space in the transmit
+ * buffer, if necessary.
+ *
+ * @param str   The string to output.
+ */
+extern void console_write(const char *str);
+
+/**
+ * Output an unsigned decimal number to the console.
+ *
+ * @param value The number to output.
+ */
+extern void console_write_uint(uint32_t value);
+
+#endif /* _CONSOLE_H */
@@ -0,0 +1,993 @@
+/*
+ * Line conversion, from captured lines to printer lines
+ */
+
+#include "conv.h"
+#include "escpos.h"
+#include <string.h>
+
+_Static_assert(CONV_GLYPH_WIDTH == ESCPOS_GLYPH_WIDTH &&
+               CONV_GLYPH_HEIGHT == ESCPOS_GLYPH_HEIGHT,
+               "Glyphs don't match printer characters");
+_Static_assert(CONV_GLYPH_CODE_BLANK >= ESCPOS_GLYPH_CODE_MIN &&
+               CONV_GLYPH_CODE_FIRST + CONV_GLYPH_NUM - 1 <=
+                    ESCPOS_GLYPH_CODE_MAX,
+               "Glyph codes exceed printer character codes");
+_Static_assert(CONV_GLYPH_NUM < CONV_GLYPH_TABLE_SIZE &&
+               CONV_GLYPH_NUM < 0xFF,
+               "Glyph hash table too small");
+_Static_assert(CONV_IN_SIZE <= 32,
+               "Band columns don't fit a word");
+
+/**
+ * Double each bit of a byte.
+ *
+ * @param byte  The byte to double bits of.
+ *
+ * @return The doubled bits, most significant first.
+ */
+static uint16_t
+conv_double_bits(uint8_t byte)
+{
+    uint32_t x = byte;
+    x = (x | (x << 4)) & 0x0F0F;
+    x = (x | (x << 2)) & 0x3333;
+    x = (x | (x << 1)) & 0x5555;
+    return x | (x << 1);
+}
+
+/**
+ * Spread the bits of a 16-bit word to the even bits of a 32-bit word.
+ *
+ * @param x The word to spread the bits of.
+ *
+ * @return The spread bits, bit N of the input being bit 2N of the output.
+ */
+static inline uint32_t
+conv_spread2(uint32_t x)
+{
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+/**
+ * Spread the bits of a byte to every third bit of a 24-bit word.
+ *
+ * @param x The byte to spread the bits of.
+ *
+ * @return The spread bits, bit N of the input being bit 3N of the output.
+ */
+static inline uint32_t
+conv_spread3(uint32_t x)
+{
+    x = (x | (x << 8)) & 0x0000F00F;
+    x = (x | (x << 4)) & 0x000C30C3;
+    x = (x | (x << 2)) & 0x00249249;
+    return x;
+}
+
+/**
+ * Compact the even bits of a 32-bit word into a 16-bit word.
+ *
+ * @param x The word to compact the even bits of.
+ *
+ * @return The compacted bits, bit 2N of the input being bit N of the
+ *         output.
+ */
+static inline uint32_t
+conv_compact2(uint32_t x)
+{
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    x = (x | (x >> 8)) & 0x0000FFFF;
+    return x;
+}
+
+/**
+ * Load a word of dots from a line, most significant first.
+ *
+ * @param ptr   Pointer to the four line bytes to load.
+ *
+ * @return The loaded word.
+ */
+static inline uint32_t
+conv_load32(const uint8_t *ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) |
+           ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+/**
+ * Scale a line twice with the Scale2x (EPX) rules, 32 dots at a time.
+ *
+ * Each dot E, with its neighbors B above, D to the left, F to the right,
+ * and H below, turns into four:
+ *
+ *      E0 E1       E0 = D == B && B != F && D != H ? D : E
+ *      E2 E3       E1 = B == F && B != D && F != H ? F : E
+ *                  E2 = D == H && D != B && H != F ? D : E
+ *                  E3 = H == F && D != H && B != F ? F : E
+ *
+ * @param rows  Location for the two output rows (top with E0/E1, bottom
+ *              with E2/E3), each as words of left (E0/E2) and right
+ *              (E1/E3) dots, matching the input words.
+ * @param up    The line above, zero-padded to a whole number of words.
+ * @param cur   The line to scale, zero-padded to a whole number of words.
+ * @param down  The line below, zero-padded to a whole number of words.
+ * @param words Number of words in the lines, up to CONV_IN_WORDS.
+ */
+static void
+conv_scale2x(uint32_t (*rows)[2][CONV_IN_WORDS],
+             const uint8_t *up, const uint8_t *cur, const uint8_t *down,
+             size_t words)
+{
+    uint32_t prev = 0;
+    uint32_t e = conv_load32(cur);
+    uint32_t next, b, d, f, h, c;
+    size_t i;
+
+    for (i = 0; i < words; i++) {
+        next = i + 1 < words ? conv_load32(cur + (i + 1) * 4) : 0;
+        b = conv_load32(up + i * 4);
+        h = conv_load32(down + i * 4);
+        d = (e >> 1) | (prev << 31);
+        f = (e << 1) | (next >> 31);
+
+        c = ~(d ^ b) & (b ^ f) & (d ^ h);
+        rows[0][0][i] = (c & d) | (~c & e);
+        c = ~(b ^ f) & (b ^ d) & (f ^ h);
+        rows[0][1][i] = (c & f) | (~c & e);
+        c = ~(d ^ h) & (d ^ b) & (h ^ f);
+        rows[1][0][i] = (c & d) | (~c & e);
+        c = ~(h ^ f) & (d ^ h) & (b ^ f);
+        rows[1][1][i] = (c & f) | (~c & e);
+
+        prev = e;
+        e = next;
+    }
+}
+
+/**
+ * Set the output line length to the position after its last non-blank
+ * byte, and mark it pending, or count it as a blank line to feed.
+ *
+ * @param conv  The conversion state with the output line filled in.
+ * @param size  Number of output line bytes which could be non-blank.
+ */
+static void
+conv_out_finish(struct conv *conv, size_t size)
+{
+    while (size > 0 && conv->out[size - 1] == 0) {
+        size--;
+    }
+    if (size == 0) {
+        conv->feed++;
+    } else {
+        conv->out_len = size;
+        conv->out_pending = true;
+    }
+}
+
+/**
+ * Empty the glyph cache.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_glyph_reset(struct conv *conv)
+{
+    memset(conv->glyph_used, 0, sizeof(conv->glyph_used));
+    memset(conv->glyph_table, 0, sizeof(conv->glyph_table));
+    conv->band_count = 0;
+}
+
+void
+conv_init(struct conv *conv, enum conv_mode mode)
+{
+    conv->mode = mode;
+    conv->out_pending = false;
+    conv->feed = 0;
+    conv->feed_flush = false;
+    conv->text_pending = false;
+    frame_init(&conv->frame);
+    conv->frame_output = false;
+    memset(conv->line_win, 0, sizeof(conv->line_win));
+    conv->line_num = 0;
+    conv->line_row_num = 0;
+    conv->line_row = 0;
+    conv->glyph = false;
+    conv->glyph_next = false;
+    conv->band_num = 0;
+    conv->band_output = false;
+    conv->band_end = false;
+    conv_glyph_reset(conv);
+    memset(&conv->glyph_stats, 0, sizeof(conv->glyph_stats));
+}
+
+void
+conv_set_glyphs(struct conv *conv, bool enabled)
+{
+    conv->glyph_next = enabled;
+    if (conv->line_num == 0 && conv->band_num == 0 && !conv->band_output) {
+        conv->glyph = enabled;
+    }
+}
+
+/**
+ * Check if bands are being collected for printing as glyphs.
+ *
+ * @param conv  The conversion state.
+ *
+ * @return True if the glyph cache is in use.
+ */
+static bool
+conv_glyph_is_active(const struct conv *conv)
+{
+    return conv->glyph && conv->mode == CONV_MODE_LINE_WIDE;
+}
+
+bool
+conv_is_ready(const struct conv *conv)
+{
+    return !conv->out_pending && !conv->frame_output &&
+           conv->line_row >= conv->line_row_num && !conv->text_pending &&
+           !conv->band_output &&
+           !conv->feed_flush && conv->feed < CONV_FEED_MAX;
+}
+
+/**
+ * Start outputting the collected frame, if it's not empty.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_frame_output_start(struct conv *conv)
+{
+    if (conv->frame.line_num > 0) {
+        conv->frame_output = true;
+        conv->frame_col = 0;
+        conv->frame_col_rep = 0;
+        if (conv->mode == CONV_MODE_FRAME_SMOOTH) {
+            /* Load the first column into the smoothing window */
+            memset(conv->frame_win, 0, sizeof(conv->frame_win));
+            conv->frame_rot_size = frame_rotate(&conv->frame, 0,
+                                                conv->frame_rot);
+            memcpy(conv->frame_win[2], conv->frame_rot[0],
+                   conv->frame_rot_size);
+        }
+    }
+}
+
+/**
+ * Schedule the output rows of the current line in the scaled line
+ * window, with the lines around it.
+ *
+ * @param conv  The conversion state.
+ * @param last  True if the line is the last one of the job.
+ */
+static void
+conv_line_schedule(struct conv *conv, bool last)
+{
+    /* Index of the current line in the job */
+    size_t index = conv->line_num - (last ? 1 : 2);
+    size_t i;
+
+    if (conv->mode == CONV_MODE_LINE_SMOOTH) {
+        conv_scale2x(conv->line_rows,
+                     conv->line_win[0], conv->line_win[1], conv->line_win[2],
+                     CONV_IN_WORDS);
+        /*
+         * Output three rows out of each four of a line pair, merging the
+         * bottom row of the even line with the top row of the odd one
+         */
+        if (index & 1) {
+            for (i = 0; i < CONV_IN_WORDS; i++) {
+                conv->line_rows[0][0][i] |= conv->line_held[0][i];
+                conv->line_rows[0][1][i] |= conv->line_held[1][i];
+            }
+            conv->line_row_num = 2;
+        } else if (last) {
+            conv->line_row_num = 2;
+        } else {
+            memcpy(conv->line_held, conv->line_rows[1],
+                   sizeof(conv->line_held));
+            conv->line_row_num = 1;
+        }
+    } else {
+        /* Output both halves of every dot the same */
+        for (i = 0; i < CONV_IN_WORDS; i++) {
+            conv->line_rows[0][0][i] = conv->line_rows[0][1][i] =
+                conv_load32(conv->line_win[1] + i * 4);
+        }
+        memcpy(conv->line_rows[1], conv->line_rows[0],
+               sizeof(conv->line_rows[1]));
+        /* Output even lines twice */
+        conv->line_row_num = (index & 1) ? 1 : 2;
+    }
+    conv->line_row = 0;
+}
+
+/**
+ * Shift an input line into the scaled line window, and schedule the
+ * output of the line it makes current, if any.
+ *
+ * @param conv  The conversion state.
+ * @param line  The input line, or NULL to shift in a blank line at the end
+ *              of a job.
+ */
+static void
+conv_line_shift(struct conv *conv, const uint8_t *line)
+{
+    memcpy(conv->line_win[0], conv->line_win[1], CONV_IN_SIZE);
+    memcpy(conv->line_win[1], conv->line_win[2], CONV_IN_SIZE);
+    if (line == NULL) {
+        memset(conv->line_win[2], 0, CONV_IN_SIZE);
+        if (conv->line_num > 0) {
+            conv_line_schedule(conv, true);
+        }
+        /* Start the next job with blank lines around */
+        memset(conv->line_win, 0, sizeof(conv->line_win));
+        conv->line_num = 0;
+    } else {
+        memcpy(conv->line_win[2], line, CONV_IN_SIZE);
+        conv->line_num++;
+        if (conv->line_num > 1) {
+            conv_line_schedule(conv, false);
+        }
+    }
+}
+
+/**
+ * Hash the glyph of a band column byte.
+ *
+ * @param conv  The conversion state with the band collected.
+ * @param col   Index of the band column byte.
+ *
+ * @return The glyph hash.
+ */
+static uint32_t
+conv_glyph_hash(const struct conv *conv, size_t col)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < CONV_GLYPH_LINES; i++) {
+        hash = (hash ^ conv->band[i][col]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Check if two band column bytes have the same glyph.
+ *
+ * @param conv  The conversion state with the band collected.
+ * @param a     Index of the first band column byte.
+ * @param b     Index of the second band column byte.
+ *
+ * @return True if the glyphs are the same.
+ */
+static bool
+conv_glyph_equal(const struct conv *conv, size_t a, size_t b)
+{
+    size_t i;
+
+    for (i = 0; i < CONV_GLYPH_LINES; i++) {
+        if (conv->band[i][a] != conv->band[i][b]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Check if a glyph cache slot holds the glyph of a band column byte.
+ *
+ * @param conv  The conversion state with the band collected.
+ * @param slot  The slot index.
+ * @param col   Index of the band column byte.
+ *
+ * @return True if the slot holds the glyph.
+ */
+static bool
+conv_glyph_is_cached(const struct conv *conv, size_t slot, size_t col)
+{
+    size_t i;
+
+    for (i = 0; i < CONV_GLYPH_LINES; i++) {
+        if (conv->glyph_tile[slot][i] != conv->band[i][col]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Get the hash table entry a glyph hash is probed from.
+ *
+ * @param hash  The glyph hash.
+ *
+ * @return The hash table entry index.
+ */
+static inline size_t
+conv_glyph_home(uint32_t hash)
+{
+    return (hash ^ (hash >> 16)) & (CONV_GLYPH_TABLE_SIZE - 1);
+}
+
+/**
+ * Find the glyph cache slot holding the glyph of a band column byte.
+ *
+ * @param conv  The conversion state with the band collected.
+ * @param col   Index of the band column byte.
+ * @param hash  The glyph hash.
+ *
+ * @return The slot index, or -1 if the glyph is not cached.
+ */
+static int
+conv_glyph_find(const struct conv *conv, size_t col, uint32_t hash)
+{
+    size_t i = conv_glyph_home(hash);
+    uint8_t entry;
+
+    while ((entry = conv->glyph_table[i]) != 0) {
+        if (conv->glyph_hash[entry - 1] == hash &&
+            conv_glyph_is_cached(conv, entry - 1, col)) {
+            return entry - 1;
+        }
+        i = (i + 1) & (CONV_GLYPH_TABLE_SIZE - 1);
+    }
+    return -1;
+}
+
+/**
+ * Add a glyph cache slot to the hash table, with the glyph hash set.
+ *
+ * @param conv  The conversion state.
+ * @param slot  The slot index.
+ */
+static void
+conv_glyph_insert(struct conv *conv, size_t slot)
+{
+    size_t i = conv_glyph_home(conv->glyph_hash[slot]);
+
+    while (conv->glyph_table[i] != 0) {
+        i = (i + 1) & (CONV_GLYPH_TABLE_SIZE - 1);
+    }
+    conv->glyph_table[i] = slot + 1;
+}
+
+/**
+ * Remove a glyph cache slot from the hash table, shifting back the entries
+ * probed past it.
+ *
+ * @param conv  The conversion state.
+ * @param slot  The slot index.
+ */
+static void
+conv_glyph_remove(struct conv *conv, size_t slot)
+{
+    size_t mask = CONV_GLYPH_TABLE_SIZE - 1;
+    size_t i = conv_glyph_home(conv->glyph_hash[slot]);
+    size_t j, home;
+
+    while (conv->glyph_table[i] != slot + 1) {
+        i = (i + 1) & mask;
+    }
+    for (j = (i + 1) & mask; conv->glyph_table[j] != 0; j = (j + 1) & mask) {
+        home = conv_glyph_home(conv->glyph_hash[conv->glyph_table[j] - 1]);
+        /* If the entry's home is not within (i, j], move it to the hole */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            conv->glyph_table[i] = conv->glyph_table[j];
+            i = j;
+        }
+    }
+    conv->glyph_table[i] = 0;
+}
+
+/**
+ * Pick the glyph cache slot to define a new glyph in: a free one, or the
+ * least recently used one, not used by the current band.
+ *
+ * @param conv  The conversion state.
+ *
+ * @return The slot index.
+ */
+static size_t
+conv_glyph_victim(const struct conv *conv)
+{
+    size_t slot = 0;
+    size_t i;
+
+    for (i = 1; i < CONV_GLYPH_NUM; i++) {
+        if (conv->glyph_used[i] < conv->glyph_used[slot]) {
+            slot = i;
+        }
+    }
+    return slot;
+}
+
+/**
+ * Render the glyph of a band column byte, scaling it 1.5 times the same
+ * way the line output does: even dots and lines take two, odd ones - one.
+ *
+ * @param conv  The conversion state with the band collected.
+ * @param col   Index of the band column byte.
+ */
+static void
+conv_glyph_render(struct conv *conv, size_t col)
+{
+    uint8_t byte;
+    size_t x, y;
+
+    memset(conv->glyph_data, 0, sizeof(conv->glyph_data));
+    for (y = 0; y < CONV_GLYPH_HEIGHT; y++) {
+        byte = conv->band[y / 3 * 2 + (y % 3 == 2)][col];
+        for (x = 0; x < CONV_GLYPH_WIDTH; x++) {
+            if ((byte << (x / 3 * 2 + (x % 3 == 2))) & 0x80) {
+                conv->glyph_data[x * (CONV_GLYPH_HEIGHT / 8) + y / 8] |=
+                    0x80 >> (y % 8);
+            }
+        }
+    }
+}
+
+/**
+ * Estimate the number of printer bytes it takes to print the collected
+ * band as dots.
+ *
+ * @param conv  The conversion state with the band collected.
+ *
+ * @return The number of bytes.
+ */
+static size_t
+conv_band_raster_size(const struct conv *conv)
+{
+    size_t size = 0;
+    bool blank = false;
+    size_t i, len;
+
+    for (i = 0; i < conv->band_num; i++) {
+        len = CONV_IN_SIZE;
+        while (len > 0 && conv->band[i][len - 1] == 0) {
+            len--;
+        }
+        if (len == 0) {
+            /* Count a feed per run of blank lines */
+            if (!blank) {
+                size += ESCPOS_FEED_SIZE;
+            }
+            blank = true;
+        } else {
+            /* Even lines are output twice */
+            size += ((i & 1) ? 1 : 2) *
+                    ESCPOS_LINE_SIZE((len * CONV_GLYPH_WIDTH + 7) / 8);
+            blank = false;
+        }
+    }
+    return size;
+}
+
+/**
+ * Start outputting the collected band as dots.
+ *
+ * @param conv  The conversion state.
+ * @param end   True if the job ends after the band.
+ */
+static void
+conv_band_raster_start(struct conv *conv, bool end)
+{
+    conv->band_output = true;
+    conv->band_raster = true;
+    conv->band_line = 0;
+    conv->band_end = end;
+}
+
+/**
+ * Finish outputting the band, and start collecting the next one.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_band_finish(struct conv *conv)
+{
+    conv->band_output = false;
+    conv->band_num = 0;
+    if (conv->band_end) {
+        conv->band_end = false;
+        conv->feed_flush = true;
+    }
+}
+
+/**
+ * Start outputting the complete collected band, either as glyphs, looking
+ * them up in the cache, or as dots, whichever takes fewer printer bytes.
+ *
+ * @param conv  The conversion state with a complete band collected.
+ */
+static void
+conv_band_output_start(struct conv *conv)
+{
+    struct conv_glyph_stats *stats = &conv->glyph_stats;
+    uint32_t hash[CONV_IN_SIZE];
+    uint32_t nonblank = 0;
+    size_t len = 0;
+    size_t defs = 0;
+    size_t raster_size, glyph_size;
+    size_t col, i, slot;
+    uint8_t dots;
+    int found;
+
+    /* Hash the non-blank glyphs and count the ones to define */
+    for (col = 0; col < CONV_IN_SIZE; col++) {
+        dots = 0;
+        for (i = 0; i < CONV_GLYPH_LINES; i++) {
+            dots |= conv->band[i][col];
+        }
+        if (dots == 0) {
+            continue;
+        }
+        nonblank |= 1u << col;
+        len = col + 1;
+        hash[col] = conv_glyph_hash(conv, col);
+        if (conv_glyph_find(conv, col, hash[col]) >= 0) {
+            continue;
+        }
+        for (i = 0; i < col; i++) {
+            if ((nonblank & (1u << i)) && hash[i] == hash[col] &&
+                conv_glyph_equal(conv, i, col)) {
+                break;
+            }
+        }
+        if (i == col) {
+            defs++;
+        }
+    }
+
+    /* Print as dots if blank, or if glyphs are not cheaper */
+    raster_size = conv_band_raster_size(conv);
+    glyph_size = ESCPOS_GLYPH_LINE_SIZE(len) +
+                 defs * ESCPOS_GLYPH_DEFINE_SIZE;
+    if (len == 0 || glyph_size >= raster_size) {
+        stats->raster_bands++;
+        conv_band_raster_start(conv, false);
+        return;
+    }
+
+    /* Look up the glyphs, defining the missing ones */
+    conv->band_count++;
+    conv->glyph_def_num = 0;
+    conv->glyph_def = 0;
+    for (col = 0; col < len; col++) {
+        if (!(nonblank & (1u << col))) {
+            conv->glyph_codes[col] = CONV_GLYPH_CODE_BLANK;
+            continue;
+        }
+        found = conv_glyph_find(conv, col, hash[col]);
+        if (found >= 0) {
+            slot = found;
+            stats->hits++;
+        } else {
+            slot = conv_glyph_victim(conv);
+            if (conv->glyph_used[slot] != 0) {
+                conv_glyph_remove(conv, slot);
+            }
+            for (i = 0; i < CONV_GLYPH_LINES; i++) {
+                conv->glyph_tile[slot][i] = conv->band[i][col];
+            }
+            conv->glyph_hash[slot] = hash[col];
+            conv_glyph_insert(conv, slot);
+            conv->glyph_defs[conv->glyph_def_num++] = col;
+            stats->uploads++;
+        }
+        conv->glyph_used[slot] = conv->band_count;
+        conv->glyph_codes[col] = CONV_GLYPH_CODE_FIRST + slot;
+    }
+    conv->glyph_codes_len = len;
+    stats->bands++;
+    stats->saved += raster_size - glyph_size;
+
+    conv->band_output = true;
+    conv->band_raster = false;
+    conv->band_end = false;
+}
+
+/**
+ * Output the dots collected so far, and schedule a text line after them.
+ *
+ * @param conv  The conversion state.
+ * @param text  The text line characters.
+ * @param len   Number of characters in the line, up to CONV_IN_SIZE.
+ */
+static void
+conv_text_put(struct conv *conv, const uint8_t *text, size_t len)
+{
+    if (conv_mode_is_frame(conv->mode)) {
+        conv_frame_output_start(conv);
+    } else if (conv_glyph_is_active(conv) && conv->band_num > 0) {
+        /* Print the partial band as dots, ending the lines */
+        conv_band_raster_start(conv, false);
+    } else if (conv->mode != CONV_MODE_LINE) {
+        conv_line_shift(conv, NULL);
+    }
+    memcpy(conv->text, text, len);
+    conv->text_len = len;
+    conv->text_pending = true;
+}
+
+void
+conv_put(struct conv *conv, const uint8_t *line,
+         const struct linemeta *meta)
+{
+    if (meta->flags & LINEMETA_FLAG_TEXT) {
+        conv_text_put(conv, line, meta->popcount);
+    } else if (conv_mode_is_frame(conv->mode)) {
+        if (frame_add(&conv->frame, line)) {
+            conv_frame_output_start(conv);
+        }
+    } else if (conv_glyph_is_active(conv)) {
+        memcpy(conv->band[conv->band_num++], line, CONV_IN_SIZE);
+        if (conv->band_num == CONV_GLYPH_LINES) {
+            conv_band_output_start(conv);
+        }
+    } else if (conv->mode != CONV_MODE_LINE) {
+        conv_line_shift(conv, line);
+    } else if (meta->flags & LINEMETA_FLAG_BLANK) {
+        conv->feed++;
+    } else {
+        conv->out_len = meta->last + 1;
+        memcpy(conv->out, line, conv->out_len);
+        conv->out_pending = true;
+    }
+}
+
+void
+conv_end(struct conv *conv)
+{
+    if (conv_mode_is_frame(conv->mode)) {
+        conv_frame_output_start(conv);
+    } else if (conv_glyph_is_active(conv) && conv->band_num > 0) {
+        /* Print the partial band as dots */
+        conv_band_raster_start(conv, true);
+    } else if (conv->mode != CONV_MODE_LINE) {
+        conv_line_shift(conv, NULL);
+    }
+    /* The frame and band output flush the feed when finished */
+    if (!conv->frame_output && !conv->band_output) {
+        conv->feed_flush = true;
+    }
+    /* Start the next job with an empty glyph cache */
+    conv_glyph_reset(conv);
+    conv->glyph = conv->glyph_next;
+}
+
+/**
+ * Produce the next output row of the current scaled line, either as the
+ * pending output line, or as a blank line to feed.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_line_next(struct conv *conv)
+{
+    const uint32_t *left = conv->line_rows[conv->line_row][0];
+    const uint32_t *right = conv->line_rows[conv->line_row][1];
+    bool smooth = conv->mode == CONV_MODE_LINE_SMOOTH;
+    uint8_t *out = conv->out;
+    uint32_t a0, mid, b1, dots;
+    size_t i;
+
+    /*
+     * Output three dots out of each four of a dot pair (a0 a1 b0 b1):
+     * a0, a1 merged with b0 when smoothing, and b1
+     */
+    for (i = 0; i < CONV_IN_WORDS; i++) {
+        a0 = conv_compact2(left[i] >> 1);
+        mid = conv_compact2(right[i] >> 1);
+        if (smooth) {
+            mid |= conv_compact2(left[i]);
+        }
+        b1 = conv_compact2(right[i]);
+
+        dots = (conv_spread3(a0 >> 8) << 2) |
+               (conv_spread3(mid >> 8) << 1) |
+               conv_spread3(b1 >> 8);
+        *out++ = dots >> 16;
+        *out++ = dots >> 8;
+        *out++ = dots;
+        dots = (conv_spread3(a0 & 0xFF) << 2) |
+               (conv_spread3(mid & 0xFF) << 1) |
+               conv_spread3(b1 & 0xFF);
+        *out++ = dots >> 16;
+        *out++ = dots >> 8;
+        *out++ = dots;
+    }
+
+    conv->line_row++;
+    conv_out_finish(conv, CONV_OUT_SIZE);
+}
+
+/**
+ * Produce the next output line of the frame being output with Scale2x
+ * smoothing, either as the pending output line, or as a blank line to
+ * feed.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_frame_smooth_next(struct conv *conv)
+{
+    size_t col = conv->frame_col;
+    size_t size = conv->frame_rot_size;
+    size_t words = (size + 3) / 4;
+    size_t offset = (CONV_OUT_SIZE - size * 2) / 2;
+    const uint32_t *left, *right;
+    uint32_t dots = 0;
+    size_t i;
+
+    /* If starting a new column, shift it into the window and scale it */
+    if (conv->frame_col_rep == 0) {
+        memcpy(conv->frame_win[0], conv->frame_win[1], FRAME_ROT_SIZE);
+        memcpy(conv->frame_win[1], conv->frame_win[2], FRAME_ROT_SIZE);
+        memset(conv->frame_win[2], 0, FRAME_ROT_SIZE);
+        if (col + 1 < FRAME_LINE_LEN) {
+            /* If the next column starts a new column byte, rotate it */
+            if ((col + 1) % 8 == 0) {
+                frame_rotate(&conv->frame, (col + 1) / 8, conv->frame_rot);
+            }
+            memcpy(conv->frame_win[2], conv->frame_rot[(col + 1) % 8],
+                   size);
+        }
+        conv_scale2x(conv->line_rows,
+                     conv->frame_win[0], conv->frame_win[1],
+                     conv->frame_win[2], words);
+    }
+
+    /* Interleave the halves of the dots of the row, centered */
+    left = conv->line_rows[conv->frame_col_rep][0];
+    right = conv->line_rows[conv->frame_col_rep][1];
+    memset(conv->out, 0, sizeof(conv->out));
+    for (i = 0; i < size * 2; i++) {
+        if (i % 4 == 0) {
+            uint32_t l = left[i / 8], r = right[i / 8];
+            if (i % 8 == 0) {
+                l >>= 16;
+                r >>= 16;
+            }
+            dots = (conv_spread2(l & 0xFFFF) << 1) |
+                   conv_spread2(r & 0xFFFF);
+        }
+        conv->out[offset + i] = dots >> (24 - (i % 4) * 8);
+    }
+    conv_out_finish(conv, offset + size * 2);
+}
+
+/**
+ * Produce the next output line of the frame being output, either as the
+ * pending output line, or as a blank line to feed.
+ *
+ * @param conv  The conversion state.
+ */
+static void
+conv_frame_next(struct conv *conv)
+{
+    size_t col = conv->frame_col;
+
+    if (conv->mode == CONV_MODE_FRAME_SMOOTH) {
+        conv_frame_smooth_next(conv);
+    } else {
+        /* If starting a new column byte, rotate it */
+        if (col % 8 == 0 && conv->frame_col_rep == 0) {
+            conv->frame_rot_size = frame_rotate(&conv->frame, col / 8,
+                                                conv->frame_rot);
+        }
+
+        /* If starting a new column, scale it twice and center it */
+        if (conv->frame_col_rep == 0) {
+            const uint8_t *rot = conv->frame_rot[col % 8];
+            size_t size = conv->frame_rot_size;
+            uint8_t *out = conv->out + (CONV_OUT_SIZE - size * 2) / 2;
+            size_t i;
+            memset(conv->out, 0, sizeof(conv->out));
+            conv->out_len = 0;
+            for (i = 0; i < size; i++) {
+                uint16_t dots = conv_double_bits(rot[i]);
+                *out++ = dots >> 8;
+                *out++ = dots;
+                if (dots != 0) {
+                    conv->out_len = out - conv->out;
+                }
+            }
+        }
+
+        if (conv->out_len == 0) {
+            conv->feed++;
+        } else {
+            conv->out_pending = true;
+        }
+    }
+
+    /* Output each column twice to keep the aspect ratio */
+    if (++conv->frame_col_rep >= 2) {
+        conv->frame_col_rep = 0;
+        if (++conv->frame_col >= FRAME_LINE_LEN) {
+            conv->frame_output = false;
+            conv->feed_flush = true;
+            frame_init(&conv->frame);
+        }
+    }
+}
+
+bool
+conv_get(struct conv *conv, struct conv_op *op)
+{
+    while (true) {
+        /* Feed the blank lines preceding the pending line first */
+        if (conv->feed > 0 &&
+            (conv->out_pending || conv->feed_flush ||
+             conv->feed >= CONV_FEED_MAX)) {
+            op->type = CONV_OP_FEED;
+            op->line = NULL;
+            op->len = conv->feed < CONV_FEED_MAX ? conv->feed : CONV_FEED_MAX;
+            conv->feed -= op->len;
+            return true;
+        } else if (conv->out_pending) {
+            op->type = CONV_OP_LINE;
+            op->line = conv->out;
+            op->len = conv->out_len;
+            conv->out_pending = false;
+            return true;
+        } else if (conv->frame_output) {
+            conv_frame_next(conv);
+        } else if (conv->line_row < conv->line_row_num) {
+            conv_line_next(conv);
+        } else if (conv->band_output && conv->band_raster) {
+            /* Shift the band through the scaled line window */
+            if (conv->band_line < conv->band_num) {
+                conv_line_shift(conv, conv->band[conv->band_line++]);
+            } else {
+                conv_line_shift(conv, NULL);
+                conv_band_finish(conv);
+            }
+        } else if (conv->band_output) {
+            /* Feed the blank lines preceding the band first */
+            if (conv->feed > 0) {
+                conv->feed_flush = true;
+                continue;
+            }
+            if (conv->glyph_def < conv->glyph_def_num) {
+                size_t col = conv->glyph_defs[conv->glyph_def++];
+                conv_glyph_render(conv, col);
+                op->type = CONV_OP_GLYPH;
+                op->line = conv->glyph_data;
+                op->len = CONV_GLYPH_SIZE;
+                op->code = conv->glyph_codes[col];
+            } else {
+                op->type = CONV_OP_GLYPH_LINE;
+                op->line = conv->glyph_codes;
+                op->len = conv->glyph_codes_len;
+                conv_band_finish(conv);
+            }
+            return true;
+        } else if (conv->text_pending) {
+            /* Feed the blank lines preceding the text first */
+            if (conv->feed > 0) {
+                conv->feed_flush = true;
+                continue;
+            }
+            op->type = CONV_OP_TEXT;
+            op->line = conv->text;
+            op->len = conv->text_len;
+            conv->text_pending = false;
+            return true;
+        } else {
+            conv->feed_flush = false;
+            return false;
+        }
+    }
+}
@@ -0,0 +1,322 @@
+/*
+ * Line conversion, from captured lines to printer lines
+ */
+
+#ifndef _CONV_H
+#define _CONV_H
+
+#include "frame.h"
+#include "linemeta.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of dots on an input line, equal to ZXPRINTER_LINE_LEN */
+#define CONV_IN_LEN     256
+
+/** Number of bytes in an input line */
+#define CONV_IN_SIZE    (CONV_IN_LEN / 8)
+
+/** Number of dots on an output line, equal to PRINTER_LINE_LEN */
+#define CONV_OUT_LEN    384
+
+/** Number of bytes in an output line */
+#define CONV_OUT_SIZE   (CONV_OUT_LEN / 8)
+
+/** Maximum number of dot lines fed by a single feed operation */
+#define CONV_FEED_MAX   255
+
+/** Number of 32-bit words in an input line */
+#define CONV_IN_WORDS   (CONV_IN_SIZE / 4)
+
+/**
+ * Number of input lines in a glyph band, two character rows, scaled 1.5
+ * times to the glyph height
+ */
+#define CONV_GLYPH_LINES    16
+
+/** Width of a glyph, a column byte of a band scaled 1.5 times, dots */
+#define CONV_GLYPH_WIDTH    12
+
+/** Height of a glyph, dots */
+#define CONV_GLYPH_HEIGHT   24
+
+/** Number of bytes in a glyph, column by column, top to bottom */
+#define CONV_GLYPH_SIZE     (CONV_GLYPH_WIDTH * CONV_GLYPH_HEIGHT / 8)
+
+/** Character code of the blank glyph, never defined */
+#define CONV_GLYPH_CODE_BLANK   0x20
+
+/** Character code of the first glyph cache slot */
+#define CONV_GLYPH_CODE_FIRST   0x21
+
+/** Number of glyph cache slots, one per definable character code */
+#define CONV_GLYPH_NUM      94
+
+/** Number of glyph cache hash table entries, a power of two */
+#define CONV_GLYPH_TABLE_SIZE   128
+
+/** Conversion mode */
+enum conv_mode {
+    /* Output each input line as is */
+    CONV_MODE_LINE,
+    /*
+     * Scale input lines 1.5 times to the full output width, duplicating
+     * every other dot and line
+     */
+    CONV_MODE_LINE_WIDE,
+    /*
+     * Scale input lines 1.5 times to the full output width, smoothing
+     * the edges with Scale2x and dropping every fourth dot and line
+     */
+    CONV_MODE_LINE_SMOOTH,
+    /*
+     * Collect a frame of up to FRAME_LINE_NUM lines and output it rotated
+     * clockwise and scaled twice, landscape
+     */
+    CONV_MODE_FRAME,
+    /* Same as CONV_MODE_FRAME, but scale with Scale2x smoothing */
+    CONV_MODE_FRAME_SMOOTH,
+};
+
+/** Output operation type */
+enum conv_op_type {
+    /* Print a line */
+    CONV_OP_LINE,
+    /* Feed blank dot lines */
+    CONV_OP_FEED,
+    /* Print a line of characters with the printer's font */
+    CONV_OP_TEXT,
+    /* Define the glyph of a user-defined character */
+    CONV_OP_GLYPH,
+    /* Print a line of user-defined characters, a whole glyph band */
+    CONV_OP_GLYPH_LINE,
+};
+
+/** Output operation */
+struct conv_op {
+    /* Operation type */
+    enum conv_op_type type;
+    /*
+     * The line (CONV_OP_LINE), or the characters (CONV_OP_TEXT,
+     * CONV_OP_GLYPH_LINE) to print, or the glyph to define, CONV_GLYPH_SIZE
+     * bytes (CONV_OP_GLYPH)
+     */
+    const uint8_t *line;
+    /*
+     * Number of leading line bytes to print, the rest being blank
+     * (CONV_OP_LINE), or number of dot lines to feed, up to CONV_FEED_MAX
+     * (CONV_OP_FEED), or number of characters to print, possibly zero
+     * (CONV_OP_TEXT, CONV_OP_GLYPH_LINE)
+     */
+    size_t len;
+    /* Character code to define the glyph for (CONV_OP_GLYPH only) */
+    uint8_t code;
+};
+
+/** Glyph cache statistics */
+struct conv_glyph_stats {
+    /* Number of bands printed as glyphs */
+    uint32_t bands;
+    /* Number of bands printed as dots, as glyphs weren't cheaper */
+    uint32_t raster_bands;
+    /* Number of glyphs printed from the cache */
+    uint32_t hits;
+    /* Number of glyphs defined */
+    uint32_t uploads;
+    /* Estimated number of printer bytes saved */
+    uint32_t saved;
+};
+
+/** Conversion state */
+struct conv {
+    /* Conversion mode */
+    enum conv_mode mode;
+    /* The output line */
+    uint8_t out[CONV_OUT_SIZE];
+    /* Number of leading output line bytes which are not blank */
+    size_t out_len;
+    /* True if the output line is waiting to be retrieved */
+    bool out_pending;
+    /* Number of blank dot lines waiting to be fed */
+    unsigned int feed;
+    /* True if the waiting blank lines should be fed without waiting for more */
+    bool feed_flush;
+    /* The text line to print after the dots collected before it */
+    uint8_t text[CONV_IN_SIZE];
+    /* Number of characters in the text line */
+    size_t text_len;
+    /* True if the text line is waiting to be retrieved */
+    bool text_pending;
+
+    /*
+     * Frame mode state
+     */
+    /* The frame being collected or output */
+    struct frame frame;
+    /* True if the frame is being output */
+    bool frame_output;
+    /* Index of the frame column to output next */
+    size_t frame_col;
+    /* Number of times the frame column was output */
+    size_t frame_col_rep;
+    /* The rotated frame columns of the current column byte */
+    uint8_t frame_rot[8][FRAME_ROT_SIZE];
+    /* Number of bytes in each rotated frame column */
+    size_t frame_rot_size;
+    /*
+     * The previous, current, and next rotated frame columns, for
+     * smoothing, zero-padded
+     */
+    uint8_t frame_win[3][FRAME_ROT_SIZE];
+
+    /*
+     * Scaled line mode state
+     */
+    /*
+     * The previous, current, and next input lines, the current one being
+     * scaled once the next one arrives
+     */
+    uint8_t line_win[3][CONV_IN_SIZE];
+    /* Number of lines input in the job */
+    size_t line_num;
+    /*
+     * The output rows of the current line, at twice the resolution: left
+     * and right halves of each input dot, as words of dots
+     */
+    uint32_t line_rows[2][2][CONV_IN_WORDS];
+    /* Number of output rows of the current line */
+    size_t line_row_num;
+    /* Index of the output row of the current line to output next */
+    size_t line_row;
+    /* The bottom row of the last even line, merged into the next row */
+    uint32_t line_held[2][CONV_IN_WORDS];
+
+    /*
+     * Glyph cache state, scaled line mode without smoothing
+     */
+    /* True if bands are printed as cached glyphs, when that's cheaper */
+    bool glyph;
+    /* The glyph cache setting to apply from the next job */
+    bool glyph_next;
+    /* The band of input lines being collected or output */
+    uint8_t band[CONV_GLYPH_LINES][CONV_IN_SIZE];
+    /* Number of lines in the band */
+    size_t band_num;
+    /* True if the band is being output */
+    bool band_output;
+    /* True if the band is output as dots, false if as glyphs */
+    bool band_raster;
+    /* Index of the band line to output next as dots */
+    size_t band_line;
+    /* True if the job ends after the band */
+    bool band_end;
+    /* Number of bands output as glyphs in the job, stamping slot use */
+    uint32_t band_count;
+    /* Character codes of the band's glyph line */
+    uint8_t glyph_codes[CONV_IN_SIZE];
+    /* Number of characters in the band's glyph line */
+    size_t glyph_codes_len;
+    /* Band column bytes of the glyphs to define before the line */
+    uint8_t glyph_defs[CONV_IN_SIZE];
+    /* Number of glyphs to define before the line */
+    size_t glyph_def_num;
+    /* Index of the glyph to define next */
+    size_t glyph_def;
+    /* The glyph being defined */
+    uint8_t glyph_data[CONV_GLYPH_SIZE];
+    /* The band column bytes of the glyph in each cache slot */
+    uint8_t glyph_tile[CONV_GLYPH_NUM][CONV_GLYPH_LINES];
+    /* Hash of the glyph in each cache slot */
+    uint32_t glyph_hash[CONV_GLYPH_NUM];
+    /* Number of the band each slot was last used by, zero if free */
+    uint32_t glyph_used[CONV_GLYPH_NUM];
+    /* Hash table of the used slots, each entry a slot index plus one */
+    uint8_t glyph_table[CONV_GLYPH_TABLE_SIZE];
+    /* Glyph cache statistics, since initialization */
+    struct conv_glyph_stats glyph_stats;
+};
+
+/**
+ * Initialize the conversion state.
+ *
+ * @param conv  The conversion state to initialize.
+ * @param mode  The conversion mode to use.
+ */
+extern void conv_init(struct conv *conv, enum conv_mode mode);
+
+/**
+ * Enable or disable printing bands of lines as user-defined characters,
+ * for the CONV_MODE_LINE_WIDE mode. Every two character rows (a band of
+ * CONV_GLYPH_LINES lines) of a job are split into glyphs a column byte
+ * wide. The glyphs recurring within a job are defined on the printer once,
+ * and a band is then printed as a line of their character codes, when
+ * that takes fewer printer bytes than printing its dots, definitions
+ * included. Applies right away between jobs, or from the next job
+ * otherwise. Disabled initially.
+ *
+ * @param conv      The conversion state.
+ * @param enabled   True to enable the glyph cache, false to disable.
+ */
+extern void conv_set_glyphs(struct conv *conv, bool enabled);
+
+/**
+ * Check if a conversion mode collects and rotates frames.
+ *
+ * @param mode  The conversion mode to check.
+ *
+ * @return True if the mode is a frame mode.
+ */
+static inline bool
+conv_mode_is_frame(enum conv_mode mode)
+{
+    return mode == CONV_MODE_FRAME || mode == CONV_MODE_FRAME_SMOOTH;
+}
+
+/**
+ * Check if conversion can accept another input line, i.e. the output of
+ * the previous ones was retrieved.
+ *
+ * @param conv  The conversion state.
+ *
+ * @return True if an input line can be accepted.
+ */
+extern bool conv_is_ready(const struct conv *conv);
+
+/**
+ * Accept an input line. Must only be called if conv_is_ready() returns
+ * true. A text line (with LINEMETA_FLAG_TEXT) is output after whatever
+ * was collected before it, as if the job ended there.
+ *
+ * @param conv  The conversion state.
+ * @param line  The input line, CONV_IN_SIZE bytes.
+ * @param meta  The input line's metadata.
+ */
+extern void conv_put(struct conv *conv, const uint8_t *line,
+                     const struct linemeta *meta);
+
+/**
+ * Signal the end of a job: the last input line has been accepted and the
+ * output of whatever was collected should follow. Must only be called if
+ * conv_is_ready() returns true.
+ *
+ * @param conv  The conversion state.
+ */
+extern void conv_end(struct conv *conv);
+
+/**
+ * Retrieve the next output operation. Consecutive blank lines are
+ * coalesced into feed operations, and printed lines are cropped after
+ * their last non-blank byte.
+ *
+ * @param conv  The conversion state.
+ * @param op    Location for the retrieved operation. The line it refers to
+ *              is valid until the next call to any of the conversion
+ *              functions.
+ *
+ * @return True if an operation was retrieved, false if there are no
+ *         operations waiting.
+ */
+extern bool conv_get(struct conv *conv, struct conv_op *op);
+
+#endif /* _CONV_H */
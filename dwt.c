@@ -0,0 +1,26 @@
+/*
+ * Data watchpoint and trace unit, cycle counter
+ */
+
+#include "dwt.h"
+
+/** Debug exception and monitor control register */
+#define DWT_DEMCR   (*(volatile uint32_t *)0xE000EDFC)
+/** DEMCR trace enable bit */
+#define DWT_DEMCR_TRCENA    (1U << 24)
+
+/** DWT control register */
+#define DWT_CTRL    (*(volatile uint32_t *)0xE0001000)
+/** DWT_CTRL cycle counter enable bit */
+#define DWT_CTRL_CYCCNTENA  (1U << 0)
+
+uint32_t dwt_cycles_per_us;
+
+void
+dwt_init(uint32_t core_hz)
+{
+    dwt_cycles_per_us = core_hz / 1000000;
+    DWT_DEMCR |= DWT_DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
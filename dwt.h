@@ -0,0 +1,49 @@
+/*
+ * Data watchpoint and trace unit, cycle counter
+ */
+
+#ifndef _DWT_H
+#define _DWT_H
+
+#include <stdint.h>
+
+/** DWT cycle count register */
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+
+/** Number of core clock cycles per microsecond, set by dwt_init() */
+extern uint32_t dwt_cycles_per_us;
+
+/**
+ * Initialize and start the cycle counter.
+ *
+ * @param core_hz   Frequency of the core clock, Hz, a multiple of 1MHz.
+ */
+extern void dwt_init(uint32_t core_hz);
+
+/**
+ * Get the current value of the cycle counter.
+ *
+ * @return The number of core clock cycles passed since dwt_init(),
+ *         modulo 2^32.
+ */
+static inline uint32_t
+dwt_cycles(void)
+{
+    return DWT_CYCCNT;
+}
+
+/**
+ * Wait for the specified time by spinning on the cycle counter.
+ * Only meant for delays too short to schedule a timer for.
+ *
+ * @param us    Time to wait, microseconds, less than 2^32 cycles.
+ */
+static inline void
+dwt_delay_us(uint32_t us)
+{
+    uint32_t start = dwt_cycles();
+    uint32_t cycles = us * dwt_cycles_per_us;
+    while (dwt_cycles() - start < cycles);
+}
+
+#endif /* _DWT_H */
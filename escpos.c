@@ -0,0 +1,99 @@
+/*
+ * Thermal printer command encoding
+ */
+
+#include "escpos.h"
+#include <string.h>
+
+size_t
+escpos_reset(uint8_t *buf)
+{
+    /* ESC @ */
+    buf[0] = 0x1B;
+    buf[1] = 0x40;
+    return ESCPOS_RESET_SIZE;
+}
+
+size_t
+escpos_config(uint8_t *buf, uint8_t dots, uint8_t time, uint8_t interval)
+{
+    /* ESC 7 n1 n2 n3 */
+    buf[0] = 0x1B;
+    buf[1] = 0x37;
+    buf[2] = dots;
+    buf[3] = time;
+    buf[4] = interval;
+    return ESCPOS_CONFIG_SIZE;
+}
+
+size_t
+escpos_feed(uint8_t *buf, unsigned int lines)
+{
+    /* ESC J n */
+    buf[0] = 0x1B;
+    buf[1] = 0x4A;
+    buf[2] = lines;
+    return ESCPOS_FEED_SIZE;
+}
+
+size_t
+escpos_line(uint8_t *buf, const uint8_t *line, size_t len)
+{
+    /* DC2 * r n, for a single row of n bytes */
+    buf[0] = 0x12;
+    buf[1] = 0x2A;
+    buf[2] = 0x01;
+    buf[3] = len;
+    memcpy(buf + 4, line, len);
+    return ESCPOS_LINE_SIZE(len);
+}
+
+size_t
+escpos_text(uint8_t *buf, const uint8_t *text, size_t len)
+{
+    /* The characters, then LF */
+    memcpy(buf, text, len);
+    buf[len] = 0x0A;
+    return ESCPOS_TEXT_SIZE(len);
+}
+
+size_t
+escpos_glyph_define(uint8_t *buf, uint8_t code, const uint8_t *glyph)
+{
+    /* ESC & y c1 c2 x d1...d(y*x), for a single character */
+    buf[0] = 0x1B;
+    buf[1] = 0x26;
+    buf[2] = ESCPOS_GLYPH_HEIGHT / 8;
+    buf[3] = code;
+    buf[4] = code;
+    buf[5] = ESCPOS_GLYPH_WIDTH;
+    memcpy(buf + 6, glyph, ESCPOS_GLYPH_SIZE);
+    return ESCPOS_GLYPH_DEFINE_SIZE;
+}
+
+size_t
+escpos_glyph_line(uint8_t *buf, const uint8_t *codes, size_t len)
+{
+    uint8_t *p = buf;
+
+    /* ESC 3 n, spacing lines by the glyph height */
+    *p++ = 0x1B;
+    *p++ = 0x33;
+    *p++ = ESCPOS_GLYPH_HEIGHT;
+    /* ESC % 1, selecting user-defined characters */
+    *p++ = 0x1B;
+    *p++ = 0x25;
+    *p++ = 0x01;
+    /* The characters, then LF */
+    memcpy(p, codes, len);
+    p += len;
+    *p++ = 0x0A;
+    /* ESC % 0, back to the font */
+    *p++ = 0x1B;
+    *p++ = 0x25;
+    *p++ = 0x00;
+    /* ESC 2, back to the default spacing */
+    *p++ = 0x1B;
+    *p++ = 0x32;
+    return p - buf;
+}
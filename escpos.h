@@ -0,0 +1,142 @@
+/*
+ * Thermal printer command encoding
+ */
+
+#ifndef _ESCPOS_H
+#define _ESCPOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default max simultaneously heated dots, in units of 8 dots minus one */
+#define ESCPOS_HEAT_DOTS_DEFAULT        0x02
+/** Default heating time, in 10us units */
+#define ESCPOS_HEAT_TIME_DEFAULT        0xB0
+/** Default heating interval, in 10us units */
+#define ESCPOS_HEAT_INTERVAL_DEFAULT    0x0C
+
+/** Size of the reset command */
+#define ESCPOS_RESET_SIZE   2
+/** Size of the configuration command */
+#define ESCPOS_CONFIG_SIZE  5
+/** Size of the feed command */
+#define ESCPOS_FEED_SIZE    3
+/** Maximum number of dot lines fed by a single feed command */
+#define ESCPOS_FEED_MAX     255
+/** Size of the command printing a line of the specified number of bytes */
+#define ESCPOS_LINE_SIZE(_len)  (4 + (_len))
+/** Maximum number of bytes in a line printed by a single command */
+#define ESCPOS_LINE_MAX     255
+/** Size of the commands printing a text line of the specified length */
+#define ESCPOS_TEXT_SIZE(_len)  ((_len) + 1)
+/** Width of a user-defined character (glyph) of the default font, dots */
+#define ESCPOS_GLYPH_WIDTH  12
+/** Height of a user-defined character (glyph) of the default font, dots */
+#define ESCPOS_GLYPH_HEIGHT 24
+/** Number of bytes in a glyph */
+#define ESCPOS_GLYPH_SIZE   (ESCPOS_GLYPH_WIDTH * ESCPOS_GLYPH_HEIGHT / 8)
+/** Lowest character code a glyph can be defined for */
+#define ESCPOS_GLYPH_CODE_MIN   0x20
+/** Highest character code a glyph can be defined for */
+#define ESCPOS_GLYPH_CODE_MAX   0x7E
+/** Size of the command defining a glyph */
+#define ESCPOS_GLYPH_DEFINE_SIZE    (6 + ESCPOS_GLYPH_SIZE)
+/** Size of the commands printing a line of the specified number of glyphs */
+#define ESCPOS_GLYPH_LINE_SIZE(_len)    ((_len) + 12)
+
+/**
+ * Encode the command resetting the printer to its power-on state.
+ *
+ * @param buf   The buffer to put the command into, at least
+ *              ESCPOS_RESET_SIZE bytes.
+ *
+ * @return The command size, bytes.
+ */
+extern size_t escpos_reset(uint8_t *buf);
+
+/**
+ * Encode the command configuring the printer's heating.
+ *
+ * @param buf       The buffer to put the command into, at least
+ *                  ESCPOS_CONFIG_SIZE bytes.
+ * @param dots      Max simultaneously heated dots, in units of 8 dots
+ *                  minus one.
+ * @param time      Heating time, in 10us units.
+ * @param interval  Heating interval, in 10us units.
+ *
+ * @return The command size, bytes.
+ */
+extern size_t escpos_config(uint8_t *buf,
+                            uint8_t dots, uint8_t time, uint8_t interval);
+
+/**
+ * Encode the command feeding blank dot lines.
+ *
+ * @param buf   The buffer to put the command into, at least
+ *              ESCPOS_FEED_SIZE bytes.
+ * @param lines Number of dot lines to feed, 1 to ESCPOS_FEED_MAX.
+ *
+ * @return The command size, bytes.
+ */
+extern size_t escpos_feed(uint8_t *buf, unsigned int lines);
+
+/**
+ * Encode the command printing a line of dots, starting from the left
+ * edge.
+ *
+ * @param buf   The buffer to put the command into, at least
+ *              ESCPOS_LINE_SIZE(len) bytes.
+ * @param line  The line bytes, each bit standing for a dot, most
+ *              significant first: zero for blank, one for black.
+ * @param len   Number of bytes in the line, 1 to ESCPOS_LINE_MAX.
+ *
+ * @return The command size, bytes.
+ */
+extern size_t escpos_line(uint8_t *buf, const uint8_t *line, size_t len);
+
+/**
+ * Encode the commands printing a line of text with the printer's current
+ * font, starting from the left edge, and moving to the next line.
+ *
+ * @param buf   The buffer to put the commands into, at least
+ *              ESCPOS_TEXT_SIZE(len) bytes.
+ * @param text  The text characters, printable ASCII.
+ * @param len   Number of characters, zero to feed an empty text line.
+ *
+ * @return The commands size, bytes.
+ */
+extern size_t escpos_text(uint8_t *buf, const uint8_t *text, size_t len);
+
+/**
+ * Encode the command defining the glyph of a user-defined character.
+ *
+ * @param buf   The buffer to put the command into, at least
+ *              ESCPOS_GLYPH_DEFINE_SIZE bytes.
+ * @param code  The character code, ESCPOS_GLYPH_CODE_MIN to
+ *              ESCPOS_GLYPH_CODE_MAX.
+ * @param glyph The glyph dots, ESCPOS_GLYPH_SIZE bytes, column by column,
+ *              left to right, each column top to bottom, with the most
+ *              significant bit of each byte being the topmost dot.
+ *
+ * @return The command size, bytes.
+ */
+extern size_t escpos_glyph_define(uint8_t *buf, uint8_t code,
+                                  const uint8_t *glyph);
+
+/**
+ * Encode the commands printing a line of user-defined characters,
+ * starting from the left edge, and moving to the next line right under
+ * it. The characters not defined print with the printer's font. Leaves
+ * the printer's font selected, and the line spacing at its default.
+ *
+ * @param buf   The buffer to put the commands into, at least
+ *              ESCPOS_GLYPH_LINE_SIZE(len) bytes.
+ * @param codes The character codes.
+ * @param len   Number of characters, zero to feed an empty line.
+ *
+ * @return The commands size, bytes.
+ */
+extern size_t escpos_glyph_line(uint8_t *buf,
+                                const uint8_t *codes, size_t len);
+
+#endif /* _ESCPOS_H */
@@ -0,0 +1,121 @@
+/*
+ * Internal flash memory programming
+ */
+
+#include "flash.h"
+#include <misc.h>
+
+/** Flash memory interface registers */
+struct flash_regs {
+    /* Access control register */
+    uint32_t acr;
+    /* FPEC key register */
+    uint32_t keyr;
+    /* Option byte key register */
+    uint32_t optkeyr;
+    /* Status register */
+    uint32_t sr;
+    /* Control register */
+    uint32_t cr;
+    /* Address register */
+    uint32_t ar;
+};
+
+/** Flash memory interface registers */
+#define FLASH_REGS  ((volatile struct flash_regs *)0x40022000)
+
+/** SR busy bit */
+#define FLASH_SR_BSY        (1U << 0)
+/** SR programming error bit */
+#define FLASH_SR_PGERR      (1U << 2)
+/** SR write protection error bit */
+#define FLASH_SR_WRPRTERR   (1U << 4)
+/** SR end of operation bit */
+#define FLASH_SR_EOP        (1U << 5)
+
+/** CR programming bit */
+#define FLASH_CR_PG         (1U << 0)
+/** CR page erase bit */
+#define FLASH_CR_PER        (1U << 1)
+/** CR start bit */
+#define FLASH_CR_STRT       (1U << 6)
+/** CR lock bit */
+#define FLASH_CR_LOCK       (1U << 7)
+
+/** FPEC unlock keys */
+#define FLASH_KEY1  0x45670123
+#define FLASH_KEY2  0xCDEF89AB
+
+/** Start of the flash memory */
+#define FLASH_BASE  0x08000000
+
+/** Flash size register, KiB */
+#define FLASH_SIZE_KB   (*(const volatile uint16_t *)0x1FFFF7E0)
+
+const void *
+flash_last_page(size_t *psize)
+{
+    uint32_t size = (uint32_t)FLASH_SIZE_KB * 1024;
+    /* High-density devices have 2KiB pages, the rest - 1KiB */
+    size_t page_size = size > 128 * 1024 ? 2048 : 1024;
+
+    assert(psize != NULL);
+    *psize = page_size;
+    return (const void *)(uintptr_t)(FLASH_BASE + size - page_size);
+}
+
+/**
+ * Wait for the current flash operation to complete and check its result.
+ *
+ * @return True if the operation succeeded.
+ */
+static bool
+flash_wait(void)
+{
+    uint32_t sr;
+
+    while ((sr = FLASH_REGS->sr) & FLASH_SR_BSY);
+    /* Clear the flags by writing ones */
+    FLASH_REGS->sr = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+    return !(sr & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+}
+
+bool
+flash_write_page(const void *page, const void *data, size_t len)
+{
+    volatile uint16_t *dst = (volatile uint16_t *)page;
+    const uint16_t *src = data;
+    bool ok;
+    size_t i;
+
+    assert(page != NULL);
+    assert(data != NULL);
+    assert(len % 2 == 0);
+
+    /* Unlock the FPEC */
+    if (FLASH_REGS->cr & FLASH_CR_LOCK) {
+        FLASH_REGS->keyr = FLASH_KEY1;
+        FLASH_REGS->keyr = FLASH_KEY2;
+    }
+
+    /* Erase the page */
+    FLASH_REGS->cr |= FLASH_CR_PER;
+    FLASH_REGS->ar = (uintptr_t)page;
+    FLASH_REGS->cr |= FLASH_CR_STRT;
+    ok = flash_wait();
+    FLASH_REGS->cr &= ~FLASH_CR_PER;
+
+    /* Program the data, a half-word at a time */
+    if (ok) {
+        FLASH_REGS->cr |= FLASH_CR_PG;
+        for (i = 0; ok && i < len / 2; i++) {
+            dst[i] = src[i];
+            ok = flash_wait() && dst[i] == src[i];
+        }
+        FLASH_REGS->cr &= ~FLASH_CR_PG;
+    }
+
+    /* Lock the FPEC */
+    FLASH_REGS->cr |= FLASH_CR_LOCK;
+    return ok;
+}
@@ -0,0 +1,36 @@
+/*
+ * Internal flash memory programming
+ */
+
+#ifndef _FLASH_H
+#define _FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Get the last page of the flash memory, kept free of the firmware for
+ * storing data.
+ *
+ * @param psize Location for the page size, bytes.
+ *
+ * @return Pointer to the page, readable directly.
+ */
+extern const void *flash_last_page(size_t *psize);
+
+/**
+ * Erase a flash page and program data into it. The core stalls on any
+ * flash access, including instruction fetches and interrupt vector reads,
+ * while the page is being erased, for up to 40ms, and while each
+ * half-word is being programmed.
+ *
+ * @param page  The page to write, as returned by flash_last_page().
+ * @param data  The data to program, half-word aligned.
+ * @param len   Length of the data, bytes, even, up to the page size.
+ *
+ * @return True if the data was programmed and verified, false otherwise.
+ */
+extern bool flash_write_page(const void *page, const void *data, size_t len);
+
+#endif /* _FLASH_H */
@@ -0,0 +1,85 @@
+/*
+ * Full-frame buffer, rotated by 90 degrees
+ */
+
+#include "frame.h"
+#include <string.h>
+
+void
+frame_transpose8(uint8_t *dst, ptrdiff_t dst_stride,
+                 const uint8_t *src, ptrdiff_t src_stride)
+{
+    uint32_t x, y, t;
+
+    /* Load the rows into two words, top half and bottom half */
+    x = ((uint32_t)src[0] << 24) |
+        ((uint32_t)src[src_stride] << 16) |
+        ((uint32_t)src[2 * src_stride] << 8) |
+        src[3 * src_stride];
+    y = ((uint32_t)src[4 * src_stride] << 24) |
+        ((uint32_t)src[5 * src_stride] << 16) |
+        ((uint32_t)src[6 * src_stride] << 8) |
+        src[7 * src_stride];
+
+    /* Swap bits within 2x2 blocks */
+    t = (x ^ (x >> 7)) & 0x00AA00AA;
+    x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;
+    y = y ^ t ^ (t << 7);
+
+    /* Swap 2x2 blocks within 4x4 blocks */
+    t = (x ^ (x >> 14)) & 0x0000CCCC;
+    x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC;
+    y = y ^ t ^ (t << 14);
+
+    /* Swap 4x4 blocks between the halves */
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+
+    dst[0] = x >> 24;
+    dst[dst_stride] = x >> 16;
+    dst[2 * dst_stride] = x >> 8;
+    dst[3 * dst_stride] = x;
+    dst[4 * dst_stride] = y >> 24;
+    dst[5 * dst_stride] = y >> 16;
+    dst[6 * dst_stride] = y >> 8;
+    dst[7 * dst_stride] = y;
+}
+
+void
+frame_init(struct frame *frame)
+{
+    memset(frame->lines, 0, sizeof(frame->lines));
+    frame->line_num = 0;
+}
+
+bool
+frame_add(struct frame *frame, const uint8_t *line)
+{
+    memcpy(frame->lines[frame->line_num], line, FRAME_LINE_SIZE);
+    frame->line_num++;
+    return frame->line_num >= FRAME_LINE_NUM;
+}
+
+size_t
+frame_rotate(const struct frame *frame, size_t col,
+             uint8_t lines[8][FRAME_ROT_SIZE])
+{
+    size_t size = (frame->line_num + 7) / 8;
+    size_t block;
+
+    /*
+     * Transpose each 8x8 block of the column byte, going up from the
+     * bottom one, reading its lines bottom to top, so the bottom line ends
+     * up as the leftmost dot. Lines past the added ones are blank.
+     */
+    for (block = 0; block < size; block++) {
+        frame_transpose8(&lines[0][block], FRAME_ROT_SIZE,
+                         &frame->lines[(size - block) * 8 - 1][col],
+                         -(ptrdiff_t)FRAME_LINE_SIZE);
+    }
+
+    return size;
+}
@@ -0,0 +1,77 @@
+/*
+ * Full-frame buffer, rotated by 90 degrees
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Maximum number of lines in a frame, a multiple of 8 */
+#define FRAME_LINE_NUM  192
+
+/** Number of dots on a frame line, equal to ZXPRINTER_LINE_LEN */
+#define FRAME_LINE_LEN  256
+
+/** Number of bytes in a frame line */
+#define FRAME_LINE_SIZE (FRAME_LINE_LEN / 8)
+
+/** Maximum number of bytes in a rotated frame line */
+#define FRAME_ROT_SIZE  (FRAME_LINE_NUM / 8)
+
+/** A frame: a bitmap of up to FRAME_LINE_NUM lines */
+struct frame {
+    /* The lines, top to bottom */
+    uint8_t lines[FRAME_LINE_NUM][FRAME_LINE_SIZE];
+    /* Number of lines added */
+    size_t line_num;
+};
+
+/**
+ * Transpose an 8x8 bit matrix, with the most significant bit of each byte
+ * being the leftmost. Bit X of byte Y of the result is bit Y of byte X of
+ * the source.
+ *
+ * @param dst           The first byte of the destination matrix.
+ * @param dst_stride    Distance between destination bytes.
+ * @param src           The first byte of the source matrix.
+ * @param src_stride    Distance between source bytes, can be negative.
+ */
+extern void frame_transpose8(uint8_t *dst, ptrdiff_t dst_stride,
+                             const uint8_t *src, ptrdiff_t src_stride);
+
+/**
+ * Empty a frame.
+ *
+ * @param frame The frame to empty.
+ */
+extern void frame_init(struct frame *frame);
+
+/**
+ * Add a line to the bottom of a frame.
+ *
+ * @param frame The frame to add the line to, must not be full.
+ * @param line  The line to add, FRAME_LINE_SIZE bytes.
+ *
+ * @return True if the frame is full after adding, false otherwise.
+ */
+extern bool frame_add(struct frame *frame, const uint8_t *line);
+
+/**
+ * Rotate eight columns of a frame clockwise by 90 degrees, into eight
+ * lines, with the frame's bottom line at the left. The lines are padded
+ * with blank dots to a multiple of eight frame lines.
+ *
+ * @param frame The frame to rotate.
+ * @param col   Index of the byte of columns to rotate, less than
+ *              FRAME_LINE_SIZE.
+ * @param lines The buffer for the rotated lines.
+ *
+ * @return Number of bytes in each rotated line.
+ */
+extern size_t frame_rotate(const struct frame *frame, size_t col,
+                           uint8_t lines[8][FRAME_ROT_SIZE]);
+
+#endif /* _FRAME_H */
@@ -0,0 +1,342 @@
+/*
+ * Job history, keeping recently captured jobs compactly encoded for
+ * reprinting
+ */
+
+#include "history.h"
+#include <misc.h>
+#include <string.h>
+
+/*
+ * Jobs are stored as sequences of records, each starting with a header
+ * byte, the two top bits of which specify the record type, and the rest -
+ * its argument.
+ */
+/** Header type bits */
+#define HISTORY_REC_TYPE_MASK   0xC0
+/** Header argument bits */
+#define HISTORY_REC_ARG_MASK    0x3F
+/** A run of blank lines, the argument being the run length minus one */
+#define HISTORY_REC_BLANK       0x00
+/**
+ * A run of repeats of the previous non-blank line, the argument being the
+ * run length minus one
+ */
+#define HISTORY_REC_REPEAT      0x40
+/**
+ * A line cropped to its non-blank bytes, the argument being the index of
+ * the first one, followed by a byte with the index of the last one, and
+ * then the bytes themselves
+ */
+#define HISTORY_REC_LITERAL     0x80
+/**
+ * A text line, the argument being the number of characters, followed by
+ * the characters themselves
+ */
+#define HISTORY_REC_TEXT        0xC0
+
+/** Maximum number of lines in a run record */
+#define HISTORY_RUN_MAX         (HISTORY_REC_ARG_MASK + 1)
+
+_Static_assert((HISTORY_SIZE & (HISTORY_SIZE - 1)) == 0,
+               "History size is not a power of two");
+_Static_assert(HISTORY_LINE_SIZE <= HISTORY_REC_ARG_MASK,
+               "History line doesn't fit literal or text record argument");
+
+/** The encoded job storage ring buffer */
+static uint8_t history_buf[HISTORY_SIZE];
+
+/** Number of bytes written to the storage */
+static uint32_t history_head;
+
+/** Number of bytes written to the storage, by the start of the oldest job */
+static uint32_t history_tail;
+
+/**
+ * Number of bytes written to the storage by the start of each kept job.
+ * Job number N is stored in the slot N modulo HISTORY_JOB_NUM.
+ */
+static uint32_t history_job_start[HISTORY_JOB_NUM];
+
+/** Number of the oldest job kept */
+static uint32_t history_job_first;
+
+/** Number of the job being captured, one after the most recent one kept */
+static uint32_t history_job_last;
+
+/*
+ * Recording state
+ */
+/** Number of bytes written to the storage by the start of the current job */
+static uint32_t history_cur_start;
+/** True if the current job didn't fit and is being dropped */
+static bool history_cur_dropped;
+/** Metadata of the last literal line of the current job, if any */
+static struct linemeta history_prev_meta;
+/** The last literal line of the current job, if any */
+static uint8_t history_prev_line[HISTORY_LINE_SIZE];
+/** True if the current job has a literal line */
+static bool history_prev_valid;
+/** Type of the run record being accumulated */
+static uint8_t history_run_type;
+/** Number of lines in the run record being accumulated, zero if none */
+static unsigned int history_run_len;
+
+/*
+ * Replay state
+ */
+/** True if a job is being replayed */
+static bool history_replay_active;
+/** Number of storage bytes by the next record to replay */
+static uint32_t history_replay_pos;
+/** Number of storage bytes by the end of the job being replayed */
+static uint32_t history_replay_end;
+/** Type of the record being replayed */
+static uint8_t history_replay_type;
+/** Number of lines left to replay from the current record */
+static unsigned int history_replay_left;
+/** The last non-blank line replayed */
+static uint8_t history_replay_line[HISTORY_LINE_SIZE];
+/** Number of characters in the text line being replayed */
+static size_t history_replay_text_len;
+
+void
+history_init(void)
+{
+    history_head = 0;
+    history_tail = 0;
+    history_job_first = 0;
+    history_job_last = 0;
+    history_cur_start = 0;
+    history_cur_dropped = false;
+    history_prev_valid = false;
+    history_run_len = 0;
+    history_replay_active = false;
+}
+
+/**
+ * Evict the oldest kept job.
+ */
+static void
+history_evict(void)
+{
+    assert(history_job_first != history_job_last);
+    history_job_first++;
+    history_tail = history_job_first == history_job_last
+                        ? history_cur_start
+                        : history_job_start[history_job_first &
+                                            (HISTORY_JOB_NUM - 1)];
+}
+
+/**
+ * Append a record to the current job, evicting old jobs to make space, or
+ * dropping the current job, without evicting any, if it doesn't fit
+ * alone.
+ *
+ * @param rec   The record bytes.
+ * @param len   Number of bytes in the record.
+ */
+static void
+history_write(const uint8_t *rec, size_t len)
+{
+    size_t i;
+
+    if (history_cur_dropped) {
+        return;
+    }
+    if (history_head - history_cur_start + len > HISTORY_SIZE) {
+        history_head = history_cur_start;
+        history_cur_dropped = true;
+        return;
+    }
+    while (HISTORY_SIZE - (history_head - history_tail) < len) {
+        history_evict();
+    }
+    for (i = 0; i < len; i++) {
+        history_buf[history_head++ & (HISTORY_SIZE - 1)] = rec[i];
+    }
+}
+
+/**
+ * Write out the run record being accumulated, if any.
+ */
+static void
+history_run_flush(void)
+{
+    uint8_t rec;
+
+    if (history_run_len > 0) {
+        rec = history_run_type | (history_run_len - 1);
+        history_write(&rec, 1);
+        history_run_len = 0;
+    }
+}
+
+void
+history_put(const uint8_t *line, const struct linemeta *meta)
+{
+    uint8_t rec[2 + HISTORY_LINE_SIZE];
+    uint8_t type;
+    size_t len;
+
+    assert(!history_replay_active);
+
+    /*
+     * Repeats refer to the last literal line, screened by the metadata
+     * and confirmed by the bytes
+     */
+    if (meta->flags & LINEMETA_FLAG_TEXT) {
+        type = HISTORY_REC_TEXT;
+    } else if (meta->flags & LINEMETA_FLAG_BLANK) {
+        type = HISTORY_REC_BLANK;
+    } else if (history_prev_valid &&
+               linemeta_same(meta, &history_prev_meta) &&
+               memcmp(line, history_prev_line, HISTORY_LINE_SIZE) == 0) {
+        type = HISTORY_REC_REPEAT;
+    } else {
+        type = HISTORY_REC_LITERAL;
+        history_prev_meta = *meta;
+        memcpy(history_prev_line, line, HISTORY_LINE_SIZE);
+        history_prev_valid = true;
+    }
+
+    if (history_run_len > 0 &&
+        (type != history_run_type || history_run_len >= HISTORY_RUN_MAX)) {
+        history_run_flush();
+    }
+
+    if (type == HISTORY_REC_LITERAL) {
+        len = meta->last - meta->first + 1;
+        rec[0] = HISTORY_REC_LITERAL | meta->first;
+        rec[1] = meta->last;
+        memcpy(rec + 2, line + meta->first, len);
+        history_write(rec, 2 + len);
+    } else if (type == HISTORY_REC_TEXT) {
+        len = meta->popcount;
+        rec[0] = HISTORY_REC_TEXT | len;
+        memcpy(rec + 1, line, len);
+        history_write(rec, 1 + len);
+    } else {
+        history_run_type = type;
+        history_run_len++;
+    }
+}
+
+void
+history_end(void)
+{
+    assert(!history_replay_active);
+
+    history_run_flush();
+    if (history_cur_dropped || history_head == history_cur_start) {
+        history_head = history_cur_start;
+    } else {
+        if (history_job_last - history_job_first >= HISTORY_JOB_NUM) {
+            history_evict();
+        }
+        history_job_start[history_job_last++ & (HISTORY_JOB_NUM - 1)] =
+            history_cur_start;
+    }
+    history_cur_start = history_head;
+    history_cur_dropped = false;
+    history_prev_valid = false;
+}
+
+unsigned int
+history_job_num(void)
+{
+    return history_job_last - history_job_first;
+}
+
+size_t
+history_used(void)
+{
+    return history_head - history_tail;
+}
+
+bool
+history_replay_start(unsigned int age)
+{
+    uint32_t job;
+
+    if (history_replay_active || age >= history_job_num()) {
+        return false;
+    }
+    job = history_job_last - 1 - age;
+    history_replay_pos = history_job_start[job & (HISTORY_JOB_NUM - 1)];
+    history_replay_end = job + 1 == history_job_last
+                            ? history_cur_start
+                            : history_job_start[(job + 1) &
+                                                (HISTORY_JOB_NUM - 1)];
+    history_replay_left = 0;
+    history_replay_active = true;
+    return true;
+}
+
+/**
+ * Read the next byte of the job being replayed.
+ *
+ * @return The read byte.
+ */
+static uint8_t
+history_replay_read(void)
+{
+    return history_buf[history_replay_pos++ & (HISTORY_SIZE - 1)];
+}
+
+bool
+history_replay_next(uint8_t *line, struct linemeta *meta)
+{
+    uint8_t rec;
+    size_t i, last;
+
+    if (!history_replay_active) {
+        return false;
+    }
+
+    /* Decode the next record, if the current one is done */
+    if (history_replay_left == 0) {
+        if (history_replay_pos == history_replay_end) {
+            history_replay_active = false;
+            return false;
+        }
+        rec = history_replay_read();
+        history_replay_type = rec & HISTORY_REC_TYPE_MASK;
+        if (history_replay_type == HISTORY_REC_LITERAL) {
+            memset(history_replay_line, 0, sizeof(history_replay_line));
+            last = history_replay_read();
+            for (i = rec & HISTORY_REC_ARG_MASK; i <= last; i++) {
+                history_replay_line[i] = history_replay_read();
+            }
+            history_replay_left = 1;
+        } else if (history_replay_type == HISTORY_REC_TEXT) {
+            history_replay_text_len = rec & HISTORY_REC_ARG_MASK;
+            history_replay_left = 1;
+        } else {
+            history_replay_left = (rec & HISTORY_REC_ARG_MASK) + 1;
+        }
+    }
+
+    history_replay_left--;
+    if (history_replay_type == HISTORY_REC_TEXT) {
+        /* Text doesn't replace the line repeats refer to */
+        memset(line, 0, HISTORY_LINE_SIZE);
+        for (i = 0; i < history_replay_text_len; i++) {
+            line[i] = history_replay_read();
+        }
+        linemeta_compute_text(meta, line, history_replay_text_len);
+        return true;
+    } else if (history_replay_type == HISTORY_REC_BLANK) {
+        memset(line, 0, HISTORY_LINE_SIZE);
+    } else {
+        memcpy(line, history_replay_line, HISTORY_LINE_SIZE);
+    }
+    linemeta_compute(meta, line, HISTORY_LINE_SIZE);
+    return true;
+}
+
+bool
+history_is_replaying(void)
+{
+    return history_replay_active;
+}
@@ -0,0 +1,89 @@
+/*
+ * Job history, keeping recently captured jobs compactly encoded for
+ * reprinting
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include "linemeta.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of bytes in a history line, equal to LINES_LINE_SIZE */
+#define HISTORY_LINE_SIZE   32
+
+/** Size of the encoded job storage, bytes, a power of two */
+#define HISTORY_SIZE        4096
+
+/** Maximum number of jobs kept, a power of two */
+#define HISTORY_JOB_NUM     8
+
+/**
+ * Initialize the job history, discarding all jobs.
+ */
+extern void history_init(void);
+
+/**
+ * Record a line of the job being captured. Evicts the oldest jobs when
+ * out of space. If the job alone doesn't fit, it's dropped instead, and
+ * the jobs still kept stay.
+ * Must not be called while replaying.
+ *
+ * @param line  The line, HISTORY_LINE_SIZE bytes.
+ * @param meta  The line's metadata.
+ */
+extern void history_put(const uint8_t *line, const struct linemeta *meta);
+
+/**
+ * Finish recording the job being captured, making it the most recent
+ * one kept. Must not be called while replaying.
+ */
+extern void history_end(void);
+
+/**
+ * Get the number of jobs kept.
+ *
+ * @return Number of jobs available for replay.
+ */
+extern unsigned int history_job_num(void);
+
+/**
+ * Get the number of bytes the kept jobs and the job being captured
+ * occupy.
+ *
+ * @return Number of storage bytes used, up to HISTORY_SIZE.
+ */
+extern size_t history_used(void);
+
+/**
+ * Start replaying a kept job. Recording must be held off until the
+ * replay finishes.
+ *
+ * @param age   Age of the job to replay: zero for the most recent one.
+ *
+ * @return True if the replay started, false if there is no such job, or
+ *         a replay is already in progress.
+ */
+extern bool history_replay_start(unsigned int age);
+
+/**
+ * Retrieve the next line of the job being replayed.
+ *
+ * @param line  Location for the line, HISTORY_LINE_SIZE bytes.
+ * @param meta  Location for the line's metadata.
+ *
+ * @return True if a line was retrieved, false if the job has ended, and
+ *         so the replay has finished.
+ */
+extern bool history_replay_next(uint8_t *line, struct linemeta *meta);
+
+/**
+ * Check if a job is being replayed.
+ *
+ * @return True if a replay is in progress.
+ */
+extern bool history_is_replaying(void);
+
+#endif /* _HISTORY_H */
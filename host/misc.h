@@ -0,0 +1,13 @@
+/*
+ * Host build stand-in for libstammer's misc.h
+ */
+
+#ifndef _MISC_H
+#define _MISC_H
+
+#include <assert.h>
+
+/** Number of elements in an array */
+#define ARRAY_SIZE(_a)  (sizeof(_a) / sizeof((_a)[0]))
+
+#endif /* _MISC_H */
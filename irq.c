@@ -0,0 +1,51 @@
+/*
+ * Interrupt priority plan and critical sections
+ */
+
+#include "irq.h"
+#include <misc.h>
+
+/** NVIC interrupt priority registers, a byte per interrupt */
+#define IRQ_NVIC_IPR    ((volatile uint8_t *)0xE000E400)
+
+/** SysTick exception priority byte of the system handler priority registers */
+#define IRQ_SHPR_SYSTICK    (*(volatile uint8_t *)0xE000ED23)
+
+/**
+ * Convert an interrupt priority to a priority register value.
+ *
+ * @param prio  The priority to convert.
+ *
+ * @return The priority register value.
+ */
+static uint8_t
+irq_prio_val(enum irq_prio prio)
+{
+    assert(prio < (1 << IRQ_PRIO_BITS));
+    return prio << (8 - IRQ_PRIO_BITS);
+}
+
+void
+irq_set_prio(enum nvic_int irq, enum irq_prio prio)
+{
+    IRQ_NVIC_IPR[irq] = irq_prio_val(prio);
+}
+
+void
+irq_set_prio_ext(unsigned int line, enum irq_prio prio)
+{
+    assert(line < 16);
+    if (line < 5) {
+        irq_set_prio(NVIC_INT_EXTI0 + line, prio);
+    } else if (line < 10) {
+        irq_set_prio(NVIC_INT_EXTI9_5, prio);
+    } else {
+        irq_set_prio(NVIC_INT_EXTI15_10, prio);
+    }
+}
+
+void
+irq_set_prio_systick(enum irq_prio prio)
+{
+    IRQ_SHPR_SYSTICK = irq_prio_val(prio);
+}
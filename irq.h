@@ -0,0 +1,87 @@
+/*
+ * Interrupt priority plan and critical sections
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include <nvic.h>
+#include <stdint.h>
+
+/** Number of priority bits implemented by the NVIC, the upper ones */
+#define IRQ_PRIO_BITS   4
+
+/**
+ * Interrupt priorities, the lower the more urgent. Each level preempts
+ * the ones below it, interrupts of the same level don't preempt each
+ * other.
+ */
+enum irq_prio {
+    /*
+     * ZX Spectrum bus: the WRITE edge, which must reset the PAPER and
+     * ENCODER latches before the Spectrum reads them again. Never masked.
+     */
+    IRQ_PRIO_ZX_BUS,
+    /* ZX Printer encoder disc and motor timing */
+    IRQ_PRIO_ZX_ENCODER,
+    /*
+     * Housekeeping: software timers, printer communication and status,
+     * USB. Masked by irq_lock().
+     */
+    IRQ_PRIO_HOUSEKEEPING,
+};
+
+/**
+ * Set the priority of an interrupt.
+ *
+ * @param irq   The interrupt to set the priority of.
+ * @param prio  The priority to set.
+ */
+extern void irq_set_prio(enum nvic_int irq, enum irq_prio prio);
+
+/**
+ * Set the priority of the interrupt of an EXTI line.
+ *
+ * @param line  The EXTI line (pin) number, 0-15.
+ * @param prio  The priority to set.
+ */
+extern void irq_set_prio_ext(unsigned int line, enum irq_prio prio);
+
+/**
+ * Set the priority of the SysTick exception.
+ *
+ * @param prio  The priority to set.
+ */
+extern void irq_set_prio_systick(enum irq_prio prio);
+
+/**
+ * Enter a critical section with respect to the housekeeping interrupts,
+ * by raising BASEPRI, leaving the ZX Printer interrupts running.
+ * Can be nested.
+ *
+ * @return The previous BASEPRI value, to pass to irq_unlock().
+ */
+static inline __attribute__ ((always_inline)) uint32_t
+irq_lock(void)
+{
+    uint32_t basepri;
+    asm volatile ("mrs %0, basepri" : "=r" (basepri) :: "memory");
+    /* Only raise the masked priority, never lower it */
+    asm volatile ("msr basepri_max, %0"
+                  :: "r" (IRQ_PRIO_HOUSEKEEPING << (8 - IRQ_PRIO_BITS))
+                  : "memory");
+    return basepri;
+}
+
+/**
+ * Leave a critical section entered with irq_lock().
+ *
+ * @param basepri   The BASEPRI value returned by the matching irq_lock().
+ */
+static inline __attribute__ ((always_inline)) void
+irq_unlock(uint32_t basepri)
+{
+    asm volatile ("msr basepri, %0" :: "r" (basepri) : "memory");
+}
+
+#endif /* _IRQ_H */
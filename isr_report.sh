@@ -0,0 +1,200 @@
+#!/bin/sh
+#
+# Report size, stack usage, and a static cycle estimate for interrupt
+# handlers of a Cortex-M3 firmware image, and fail if any estimate exceeds
+# its budget.
+#
+# Usage: isr_report.sh CCPFX ELF "SU_FILES" FUNCTION:BUDGET...
+#
+# The cycle estimate is an upper bound for loop-free code: every
+# instruction of the handler and of everything it calls is counted once,
+# with worst-case Cortex-M3 timings, plus the exception entry and exit.
+# Code outside RAM is charged the flash wait states for each instruction
+# fetch and literal load, and handlers calling into it are marked. Handlers
+# containing loops are marked, and the estimate only covers one pass
+# through them.
+#
+# The SU_FILES should come from the final compilation, i.e. the link with
+# link-time optimization, so they account for inlining across modules.
+#
+set -eu
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 CCPFX ELF \"SU_FILES\" FUNCTION:BUDGET..." >&2
+    exit 2
+fi
+
+ccpfx="$1"
+elf="$2"
+su_files="$3"
+shift 3
+
+# Flash wait states at the core clock, two above 48MHz
+FLASH_WAIT_STATES=${FLASH_WAIT_STATES:-2}
+
+disasm=$(mktemp)
+trap 'rm -f "$disasm"' EXIT
+"${ccpfx}objdump" -d --no-show-raw-insn "$elf" > "$disasm"
+
+printf '%-28s %6s %6s %7s %7s  %s\n' \
+       FUNCTION SIZE STACK CYCLES BUDGET STATUS
+status=0
+for spec in "$@"; do
+    func="${spec%%:*}"
+    budget="${spec#*:}"
+    size=$("${ccpfx}nm" -S "$elf" |
+           awk -v f="$func" '$4 == f {print $2; exit}')
+    if [ -n "$size" ]; then
+        size=$((0x$size))
+    fi
+    # shellcheck disable=SC2086
+    stack=$(cat $su_files 2>/dev/null |
+            awk -F '\t' -v f="$func" \
+                '{n = split($1, a, ":")} a[n] == f {print $2; exit}')
+    estimate=$(awk -v root="$func" -v wait_states="$FLASH_WAIT_STATES" '
+        # Convert a hexadecimal number
+        function hex(str,   i, n) {
+            n = 0
+            for (i = 1; i <= length(str); i++) {
+                n = n * 16 + index("0123456789abcdef", substr(str, i, 1)) - 1
+            }
+            return n
+        }
+        # Count registers in a register list operand
+        function reg_num(ops,   list, n) {
+            if (!match(ops, /\{[^}]*\}/)) {
+                return 1
+            }
+            list = substr(ops, RSTART + 1, RLENGTH - 2)
+            n = gsub(/,/, ",", list) + 1
+            return n
+        }
+        # Worst-case cycles of an instruction, excluding called functions
+        function insn_cycles(m, ops) {
+            sub(/\.[nw]$/, "", m)
+            if (m ~ /^(push|pop|ldm|stm)/) {
+                return 1 + reg_num(ops) + (ops ~ /pc/ ? 3 : 0)
+            } else if (m ~ /^(b|bx|bl|blx|cbz|cbnz|tbb|tbh)$/ ||
+                       m ~ /^b(eq|ne|cs|cc|hs|lo|mi|pl|vs|vc|hi|ls|ge|lt|gt|le|al)$/) {
+                return 4
+            } else if (m ~ /^ldrd/) {
+                return 3
+            } else if (m ~ /^(ldr|str)/) {
+                return ops ~ /^pc,/ ? 4 : 2
+            } else if (m ~ /^(udiv|sdiv)/) {
+                return 12
+            } else if (m ~ /^(umull|smull|umlal|smlal)/) {
+                return 5
+            } else if (m ~ /^(mul|mla|mls)/) {
+                return 2
+            }
+            return 1
+        }
+        # Total cycles of a function and everything it calls
+        function func_cycles(f,   total, i, callee) {
+            if (f in memo) {
+                return memo[f]
+            }
+            if (f in visiting) {
+                loop = 1
+                return 0
+            }
+            visiting[f] = 1
+            total = own[f]
+            if (f in in_flash) {
+                flash = 1
+            }
+            for (i = 1; i <= ncalls[f]; i++) {
+                callee = calls[f, i]
+                total += func_cycles(callee)
+            }
+            # Linker veneers jump to the function they are named after
+            if (f ~ /^__.*_veneer$/) {
+                callee = f
+                sub(/^__/, "", callee)
+                sub(/_veneer$/, "", callee)
+                total += func_cycles(callee)
+            }
+            if (f in loops) {
+                loop = 1
+            }
+            delete visiting[f]
+            memo[f] = total
+            return total
+        }
+        # Function start
+        /^[0-9a-f]+ <[^>]+>:$/ {
+            cur = $2
+            gsub(/[<>:]/, "", cur)
+            own[cur] = 0
+            ncalls[cur] = 0
+            # Below the SRAM is the code memory, i.e. flash
+            if (hex($1) < hex("20000000")) {
+                in_flash[cur] = 1
+            }
+            next
+        }
+        # Instruction
+        /^ *[0-9a-f]+:\t/ && cur != "" {
+            split($0, field, "\t")
+            addr = field[1]
+            sub(/^ */, "", addr)
+            sub(/:$/, "", addr)
+            m = field[2]
+            ops = field[3]
+            if (m ~ /^\./) {
+                # Literal pool data
+                next
+            }
+            own[cur] += insn_cycles(m, ops)
+            if (cur in in_flash) {
+                own[cur] += wait_states
+                if (m ~ /^ldr/ && ops ~ /\[pc/) {
+                    own[cur] += wait_states
+                }
+            }
+            if (match(ops, /^[0-9a-f]+ </)) {
+                target = substr(ops, 1, RLENGTH - 2)
+                if (m ~ /^blx?$/) {
+                    name = ops
+                    sub(/^[^<]*</, "", name)
+                    sub(/[+>].*$/, "", name)
+                    calls[cur, ++ncalls[cur]] = name
+                } else if (hex(target) <= hex(addr)) {
+                    loops[cur] = 1
+                }
+            }
+        }
+        END {
+            if (!(root in own)) {
+                print "- "
+                exit
+            }
+            # Exception entry and exit
+            cycles = func_cycles(root) + 12 + 10
+            note = (loop ? "loop" : "")
+            if (flash) {
+                note = note (note == "" ? "" : ",") "flash"
+            }
+            print cycles, note
+        }
+    ' "$disasm")
+    cycles="${estimate% *}"
+    note="${estimate#* }"
+    if [ "$cycles" = "-" ]; then
+        verdict="MISSING"
+        status=1
+    elif [ "$cycles" -gt "$budget" ]; then
+        verdict="OVER"
+        status=1
+    else
+        verdict="ok"
+    fi
+    if [ -n "$note" ] && [ "$note" != "$estimate" ]; then
+        verdict="$verdict ($note)"
+    fi
+    printf '%-28s %6s %6s %7s %7s  %s\n' \
+           "$func" "${size:--}" "${stack:--}" "$cycles" "$budget" "$verdict"
+done
+
+exit $status
@@ -0,0 +1,41 @@
+/*
+ * ZX Printer WRITE latency probe
+ */
+
+#include "latency.h"
+#include <misc.h>
+
+volatile uint16_t latency_max;
+volatile uint32_t latency_count;
+volatile struct tim *latency_tim = NULL;
+
+void
+latency_init(volatile struct tim *tim)
+{
+    assert(latency_tim == NULL);
+    assert(tim != NULL);
+
+    latency_reset();
+
+    /* Count every clock cycle, over the full 16-bit range */
+    tim->psc = 0;
+    tim->arr = 0xFFFF;
+    /* Capture channel 3 from TI3, unfiltered and unprescaled */
+    tim->ccmr2 = (tim->ccmr2 & ~(TIM_CCMR2_CC3S_MASK | TIM_CCMR2_IC3F_MASK |
+                                 TIM_CCMR2_IC3PSC_MASK)) |
+                 (TIM_CCMR2_CC3S_VAL_TI3 << TIM_CCMR2_CC3S_LSB);
+    /* Capture on the rising edge */
+    tim->ccer = (tim->ccer & ~TIM_CCER_CC3P_MASK) | TIM_CCER_CC3E_MASK;
+    /* Transfer the settings and start counting */
+    tim->egr |= TIM_EGR_UG_MASK;
+    tim->cr1 |= TIM_CR1_CEN_MASK;
+
+    latency_tim = tim;
+}
+
+void
+latency_reset(void)
+{
+    latency_max = 0;
+    latency_count = 0;
+}
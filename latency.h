@@ -0,0 +1,58 @@
+/*
+ * ZX Printer WRITE latency probe
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <tim.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Written by the probe, read and reset by users.
+ */
+/**
+ * Worst-case time from a WRITE edge to the latch reset, probe timer
+ * counts (core clock cycles with the timer fed by the core clock).
+ */
+extern volatile uint16_t latency_max;
+/** Number of WRITE edges measured */
+extern volatile uint32_t latency_count;
+
+/** The probe timer, NULL if the probe is not initialized */
+extern volatile struct tim *latency_tim;
+
+/**
+ * Initialize the latency probe and start capturing WRITE edges.
+ *
+ * @param tim   The timer to use. Must be reset, fed by the core clock,
+ *              and have its channel 3 input (TI3) connected to the
+ *              ZX Printer WRITE signal, e.g. TIM4 with WRITE on PB8.
+ *              Will be configured for free-running input capture.
+ */
+extern void latency_init(volatile struct tim *tim);
+
+/**
+ * Reset the recorded latency statistics.
+ */
+extern void latency_reset(void);
+
+/**
+ * Record the latency of the last WRITE edge, i.e. the time passed since it
+ * was captured. Called right after the latches are reset.
+ */
+static inline __attribute__ ((always_inline)) void
+latency_record(void)
+{
+    volatile struct tim *tim = latency_tim;
+    if (tim != NULL) {
+        uint16_t latency = tim->cnt - tim->ccr3;
+        if (latency > latency_max) {
+            latency_max = latency;
+        }
+        latency_count++;
+    }
+}
+
+#endif /* _LATENCY_H */
@@ -0,0 +1,147 @@
+/*
+ * Line metadata, computed incrementally as line bytes complete
+ */
+
+#ifndef _LINEMETA_H
+#define _LINEMETA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Line flags */
+enum linemeta_flag {
+    /* No dots are set */
+    LINEMETA_FLAG_BLANK = 1 << 0,
+    /*
+     * The line holds characters to print with the printer's font, instead
+     * of dots, zero-padded
+     */
+    LINEMETA_FLAG_TEXT  = 1 << 1,
+};
+
+/** Line metadata */
+struct linemeta {
+    /* Rolling (FNV-1a) hash of the line bytes */
+    uint32_t hash;
+    /* Number of set dots, or of characters on a text line */
+    uint16_t popcount;
+    /* Index of the first byte with set dots, if not blank */
+    uint8_t first;
+    /* Index of the last byte with set dots, if not blank */
+    uint8_t last;
+    /* A bitmap of enum linemeta_flag values */
+    uint8_t flags;
+};
+
+/** FNV-1a hash offset basis */
+#define LINEMETA_HASH_BASIS 2166136261U
+/** FNV-1a hash prime */
+#define LINEMETA_HASH_PRIME 16777619U
+
+/**
+ * Count set bits in a byte.
+ *
+ * @param byte  The byte to count set bits in.
+ *
+ * @return Number of set bits.
+ */
+static inline __attribute__ ((always_inline)) uint32_t
+linemeta_popcount8(uint32_t byte)
+{
+    byte = byte - ((byte >> 1) & 0x55);
+    byte = (byte & 0x33) + ((byte >> 2) & 0x33);
+    return (byte + (byte >> 4)) & 0x0F;
+}
+
+/**
+ * Initialize metadata for a line with no bytes added yet.
+ *
+ * @param meta  The metadata to initialize.
+ */
+static inline __attribute__ ((always_inline)) void
+linemeta_init(struct linemeta *meta)
+{
+    meta->hash = LINEMETA_HASH_BASIS;
+    meta->popcount = 0;
+    meta->first = 0;
+    meta->last = 0;
+    meta->flags = LINEMETA_FLAG_BLANK;
+}
+
+/**
+ * Update line metadata with the next line byte.
+ *
+ * @param meta  The metadata to update.
+ * @param index Index of the byte in the line.
+ * @param byte  The byte value.
+ */
+static inline __attribute__ ((always_inline)) void
+linemeta_add(struct linemeta *meta, uint32_t index, uint32_t byte)
+{
+    if (byte != 0) {
+        if (meta->flags & LINEMETA_FLAG_BLANK) {
+            meta->flags &= ~LINEMETA_FLAG_BLANK;
+            meta->first = index;
+        }
+        meta->last = index;
+        meta->popcount += linemeta_popcount8(byte);
+    }
+    meta->hash = (meta->hash ^ byte) * LINEMETA_HASH_PRIME;
+}
+
+/**
+ * Compute metadata for a whole line at once.
+ *
+ * @param meta  The metadata to compute.
+ * @param line  The line bytes.
+ * @param size  Number of bytes in the line.
+ */
+static inline void
+linemeta_compute(struct linemeta *meta, const uint8_t *line, size_t size)
+{
+    size_t i;
+    linemeta_init(meta);
+    for (i = 0; i < size; i++) {
+        linemeta_add(meta, i, line[i]);
+    }
+}
+
+/**
+ * Compute metadata for a text line.
+ *
+ * @param meta  The metadata to compute.
+ * @param text  The line characters.
+ * @param len   Number of characters on the line, can be zero.
+ */
+static inline void
+linemeta_compute_text(struct linemeta *meta, const uint8_t *text, size_t len)
+{
+    size_t i;
+    meta->hash = LINEMETA_HASH_BASIS;
+    for (i = 0; i < len; i++) {
+        meta->hash = (meta->hash ^ text[i]) * LINEMETA_HASH_PRIME;
+    }
+    meta->popcount = len;
+    meta->first = 0;
+    meta->last = len > 0 ? len - 1 : 0;
+    meta->flags = LINEMETA_FLAG_TEXT;
+}
+
+/**
+ * Check if two lines are (almost certainly) the same, by their metadata.
+ *
+ * @param a     Metadata of one line.
+ * @param b     Metadata of another line.
+ *
+ * @return True if the lines are the same, barring a hash collision.
+ */
+static inline bool
+linemeta_same(const struct linemeta *a, const struct linemeta *b)
+{
+    return a->hash == b->hash && a->popcount == b->popcount &&
+           a->first == b->first && a->last == b->last &&
+           a->flags == b->flags;
+}
+
+#endif /* _LINEMETA_H */
@@ -0,0 +1,41 @@
+/*
+ * Input line ring buffer, filled by one input interface at a time, and
+ * read by the output dispatcher
+ */
+
+#include "lines.h"
+#include <misc.h>
+#include <stddef.h>
+
+volatile uint8_t *lines_buf = NULL;
+volatile struct linemeta *lines_meta = NULL;
+uint32_t lines_num;
+volatile enum lines_owner lines_owner;
+volatile uint32_t lines_count_in;
+volatile uint32_t lines_job_count;
+volatile uint32_t lines_job_line_count[LINES_JOB_NUM];
+volatile uint32_t lines_count_out;
+
+void
+lines_init(volatile uint8_t *buf,
+           volatile struct linemeta *meta,
+           uint32_t num)
+{
+    unsigned int i;
+
+    assert(lines_buf == NULL);
+    assert(num != 0 && (num & (num - 1)) == 0);
+
+    lines_buf = buf;
+    lines_meta = meta;
+    lines_num = num;
+    lines_owner = LINES_OWNER_NONE;
+    /* No lines input or output */
+    lines_count_in = 0;
+    lines_count_out = 0;
+    /* No jobs ended */
+    lines_job_count = 0;
+    for (i = 0; i < LINES_JOB_NUM; i++) {
+        lines_job_line_count[i] = 0;
+    }
+}
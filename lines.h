@@ -0,0 +1,173 @@
+/*
+ * Input line ring buffer, filled by one input interface at a time, and
+ * read by the output dispatcher
+ */
+
+#ifndef _LINES_H
+#define _LINES_H
+
+#include "linemeta.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of dots on a line, equal to ZXPRINTER_LINE_LEN */
+#define LINES_LINE_LEN  256
+
+/** Number of bytes in a line slot */
+#define LINES_LINE_SIZE (LINES_LINE_LEN / 8)
+
+/** Number of job end records kept, a power of two */
+#define LINES_JOB_NUM   8
+
+/** An input interface, which can own the ring buffer */
+enum lines_owner {
+    /* No input interface, the ring buffer is free */
+    LINES_OWNER_NONE,
+    /* The ZX Printer interface */
+    LINES_OWNER_ZXPRINTER,
+    /* The Centronics interface */
+    LINES_OWNER_CENTRONICS,
+    /* The synthetic load generator */
+    LINES_OWNER_LOAD,
+};
+
+/*
+ * Written on init, read by everyone.
+ */
+/** Line ring buffer, lines_num slots of LINES_LINE_SIZE bytes each */
+extern volatile uint8_t *lines_buf;
+/** Line metadata ring buffer, lines_num slots */
+extern volatile struct linemeta *lines_meta;
+/** Number of line slots in the ring buffers, a power of two */
+extern uint32_t lines_num;
+
+/*
+ * Written by the owner, read by everyone.
+ */
+/**
+ * The input interface currently owning the ring buffer, the only one
+ * allowed to input lines and end jobs.
+ */
+extern volatile enum lines_owner lines_owner;
+/**
+ * Number of lines input.
+ * Line number N is stored in the line buffer slot N modulo lines_num, and
+ * its metadata - in the same slot of the metadata buffer.
+ */
+extern volatile uint32_t lines_count_in;
+/**
+ * Number of jobs ended. A job ends when its input interface goes idle for
+ * a while after any lines were input.
+ */
+extern volatile uint32_t lines_job_count;
+/**
+ * Number of lines input by the end of each job.
+ * Job number N is stored in the slot N modulo LINES_JOB_NUM.
+ */
+extern volatile uint32_t lines_job_line_count[LINES_JOB_NUM];
+
+/*
+ * Written by the output dispatcher, read by everyone.
+ */
+/**
+ * Number of lines output. The owner must wait before inputting a line
+ * when all slots hold lines not output yet.
+ */
+extern volatile uint32_t lines_count_out;
+
+/**
+ * Initialize the line ring buffer, empty and not owned.
+ *
+ * @param buf   The line ring buffer, num slots of LINES_LINE_SIZE bytes.
+ * @param meta  The line metadata ring buffer, num slots.
+ * @param num   Number of line slots in the buffers, a power of two.
+ */
+extern void lines_init(volatile uint8_t *buf,
+                       volatile struct linemeta *meta,
+                       uint32_t num);
+
+/**
+ * Take the ownership of the ring buffer for an input interface, if it's
+ * free, or already owned by the interface. Can be called from any
+ * context.
+ *
+ * @param owner The input interface claiming the buffer.
+ *
+ * @return True if the interface owns the buffer, false if another one
+ *         does.
+ */
+static inline __attribute__ ((always_inline)) bool
+lines_claim(enum lines_owner owner)
+{
+    enum lines_owner expected = LINES_OWNER_NONE;
+    return __atomic_compare_exchange_n(&lines_owner, &expected, owner,
+                                       false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED) ||
+           expected == owner;
+}
+
+/**
+ * Give up the ownership of the ring buffer. Must only be called by the
+ * owner.
+ */
+static inline __attribute__ ((always_inline)) void
+lines_release(void)
+{
+    __atomic_store_n(&lines_owner, LINES_OWNER_NONE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check if all the line slots hold lines not output yet.
+ *
+ * @return True if no line can be input.
+ */
+static inline __attribute__ ((always_inline)) bool
+lines_is_full(void)
+{
+    return lines_count_in - lines_count_out >= lines_num;
+}
+
+/**
+ * Get the slot of the line to be input next. Must only be called by the
+ * owner, when the buffer is not full.
+ *
+ * @return The line buffer slot, LINES_LINE_SIZE bytes.
+ */
+static inline __attribute__ ((always_inline)) volatile uint8_t *
+lines_next(void)
+{
+    return lines_buf +
+           (lines_count_in & (lines_num - 1)) * LINES_LINE_SIZE;
+}
+
+/**
+ * Complete the input of the line put into the slot returned by
+ * lines_next(). Must only be called by the owner.
+ *
+ * @param meta  The metadata of the line.
+ */
+static inline __attribute__ ((always_inline)) void
+lines_put(const struct linemeta *meta)
+{
+    uint32_t count_in = lines_count_in;
+    lines_meta[count_in & (lines_num - 1)] = *meta;
+    lines_count_in = count_in + 1;
+}
+
+/**
+ * End the current job, if any lines were input since the last one ended.
+ * Must only be called by the owner.
+ */
+static inline __attribute__ ((always_inline)) void
+lines_job_end(void)
+{
+    uint32_t job_count = lines_job_count;
+    if (lines_count_in !=
+        lines_job_line_count[(job_count - 1) & (LINES_JOB_NUM - 1)]) {
+        lines_job_line_count[job_count & (LINES_JOB_NUM - 1)] =
+            lines_count_in;
+        lines_job_count = job_count + 1;
+    }
+}
+
+#endif /* _LINES_H */
@@ -0,0 +1,324 @@
+/*
+ * Synthetic line load generator, for measuring print throughput
+ */
+
+#include "load.h"
+#include "lines.h"
+#include "linemeta.h"
+#include "output.h"
+#include "printer.h"
+#include "timer.h"
+#include <misc.h>
+#include <string.h>
+
+const char *const load_pattern_names[LOAD_PATTERN_NUM] = {
+    [LOAD_PATTERN_BLANK] = "blank",
+    [LOAD_PATTERN_TEXT] = "text",
+    [LOAD_PATTERN_CHECKER] = "checker",
+    [LOAD_PATTERN_SOLID] = "solid",
+};
+
+/** Number of lines in a character row of the text pattern */
+#define LOAD_TEXT_ROW_LINES 8
+
+/** Load run state */
+enum load_state {
+    /* No run in progress */
+    LOAD_STATE_IDLE,
+    /* Waiting for the printer and the paused backends to get ready */
+    LOAD_STATE_WAITING,
+    /* Inputting the lines */
+    LOAD_STATE_INPUT,
+    /* Waiting for the lines to be printed */
+    LOAD_STATE_DRAIN,
+};
+
+struct load_report load_report;
+volatile uint32_t load_run_count;
+
+/** Run state */
+static enum load_state load_state = LOAD_STATE_IDLE;
+/** The results of the run in progress */
+static struct load_report load_run;
+/** Number of lines to input */
+static uint32_t load_lines;
+/** Tick count the first line was input at */
+static uint32_t load_start_ticks;
+/** Printer busy ticks at the start of the run */
+static uint32_t load_start_busy;
+/** Printer transmitted bytes at the start of the run */
+static uint32_t load_start_tx;
+/** Number of lines input at the end of the run's job */
+static uint32_t load_end_count;
+/** True if the last line due couldn't be input */
+static bool load_stalled;
+/** State of the pseudo-random generator picking text characters */
+static uint32_t load_random;
+/** Character codes of the text row being input, zero for a space */
+static uint8_t load_text[LINES_LINE_SIZE];
+
+/**
+ * Backends paused while a run is input, so its lines don't evict real
+ * jobs from the history, or flood the USB stream.
+ */
+static struct output *const load_paused[] = {
+    &output_history,
+    &output_usbcdc,
+};
+/** True for the paused backends to be enabled when resumed */
+static bool load_paused_enabled[ARRAY_SIZE(load_paused)];
+
+/**
+ * Check if the lossless paused backends have received all lines and job
+ * ends input so far, so pausing them loses nothing.
+ *
+ * @return True if the backends are caught up.
+ */
+static bool
+load_paused_are_idle(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(load_paused); i++) {
+        const struct output *output = load_paused[i];
+        if (output->enabled && !output->lossy &&
+            (output->count != lines_count_in ||
+             output->job != lines_job_count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Pause or resume the backends not taking the run's lines. Resumed
+ * backends get back to their state before the pause, continuing with the
+ * next line and job input.
+ *
+ * @param paused    True to pause the backends, false to resume.
+ */
+static void
+load_pause(bool paused)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(load_paused); i++) {
+        if (paused) {
+            load_paused_enabled[i] = load_paused[i]->enabled;
+        }
+        output_set_enabled(load_paused[i],
+                           !paused && load_paused_enabled[i]);
+    }
+}
+
+enum load_pattern
+load_pattern_find(const char *name)
+{
+    enum load_pattern pattern;
+    for (pattern = 0;
+         pattern < LOAD_PATTERN_NUM &&
+            strcmp(load_pattern_names[pattern], name) != 0;
+         pattern++);
+    return pattern;
+}
+
+bool
+load_start(enum load_pattern pattern, uint32_t rate, uint32_t lines)
+{
+    assert(pattern < LOAD_PATTERN_NUM);
+    assert(rate <= LOAD_RATE_MAX);
+    assert(lines != 0);
+
+    if (load_state != LOAD_STATE_IDLE) {
+        return false;
+    }
+    memset(&load_run, 0, sizeof(load_run));
+    load_run.pattern = pattern;
+    load_run.rate = rate;
+    load_lines = lines;
+    load_stalled = false;
+    load_random = 1;
+    load_state = LOAD_STATE_WAITING;
+    return true;
+}
+
+/**
+ * End the run's job, if any lines were input, and start waiting for them
+ * to print.
+ */
+static void
+load_input_end(void)
+{
+    if (lines_owner == LINES_OWNER_LOAD) {
+        lines_job_end();
+        /* Resume past the run's job, before another input can start */
+        load_pause(false);
+        lines_release();
+    }
+    load_end_count = lines_count_in;
+    load_state = LOAD_STATE_DRAIN;
+}
+
+void
+load_stop(void)
+{
+    if (load_state == LOAD_STATE_WAITING) {
+        load_state = LOAD_STATE_IDLE;
+    } else if (load_state == LOAD_STATE_INPUT) {
+        load_input_end();
+    }
+}
+
+bool
+load_is_running(void)
+{
+    return load_state != LOAD_STATE_IDLE;
+}
+
+/**
+ * Generate a line of the run's pattern.
+ *
+ * @param line  Location for the line, LINES_LINE_SIZE bytes.
+ * @param index Index of the line in the run.
+ */
+static void
+load_line_generate(uint8_t *line, uint32_t index)
+{
+    size_t i;
+    uint32_t y;
+
+    switch (load_run.pattern) {
+    case LOAD_PATTERN_BLANK:
+        memset(line, 0, LINES_LINE_SIZE);
+        break;
+    case LOAD_PATTERN_TEXT:
+        y = index % LOAD_TEXT_ROW_LINES;
+        /* Pick the characters of a new row, a third of them spaces */
+        if (y == 0) {
+            for (i = 0; i < LINES_LINE_SIZE; i++) {
+                /* xorshift32 */
+                load_random ^= load_random << 13;
+                load_random ^= load_random >> 17;
+                load_random ^= load_random << 5;
+                load_text[i] = load_random % 48;
+                if (load_text[i] >= 32) {
+                    load_text[i] = 0;
+                }
+            }
+        }
+        /* Draw the characters with blank top and bottom lines and margins */
+        for (i = 0; i < LINES_LINE_SIZE; i++) {
+            line[i] = (y == 0 || y == LOAD_TEXT_ROW_LINES - 1 ||
+                       load_text[i] == 0)
+                        ? 0
+                        : (uint8_t)((load_text[i] * 0x9E3779B1u) >>
+                                    (y * 4)) & 0x7E;
+        }
+        break;
+    case LOAD_PATTERN_CHECKER:
+        memset(line, (index & 1) ? 0x55 : 0xAA, LINES_LINE_SIZE);
+        break;
+    case LOAD_PATTERN_SOLID:
+        memset(line, 0xFF, LINES_LINE_SIZE);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+/**
+ * Input a line of the run, if the line ring buffer can take it.
+ *
+ * @return True if the line was input, false if the buffer is full, or
+ *         owned by another input.
+ */
+static bool
+load_line_put(void)
+{
+    uint8_t line[LINES_LINE_SIZE];
+    struct linemeta meta;
+    volatile uint8_t *slot;
+    uint32_t queued;
+    size_t i;
+
+    if (!lines_claim(LINES_OWNER_LOAD) || lines_is_full()) {
+        return false;
+    }
+    if (load_run.lines == 0) {
+        load_pause(true);
+        load_start_ticks = timer_ticks;
+        load_start_busy = printer_busy_total;
+        load_start_tx = printer_tx_total;
+    }
+    load_line_generate(line, load_run.lines);
+    linemeta_compute(&meta, line, LINES_LINE_SIZE);
+    slot = lines_next();
+    for (i = 0; i < LINES_LINE_SIZE; i++) {
+        slot[i] = line[i];
+    }
+    lines_put(&meta);
+    load_run.lines++;
+    queued = lines_count_in - lines_count_out;
+    if (queued > load_run.queue_max) {
+        load_run.queue_max = queued;
+    }
+    return true;
+}
+
+void
+load_poll(void)
+{
+    uint32_t due;
+
+    switch (load_state) {
+    case LOAD_STATE_IDLE:
+        break;
+    case LOAD_STATE_WAITING:
+        /* Don't count the printer initialization in */
+        if (printer_is_ready() && load_paused_are_idle() &&
+            load_line_put()) {
+            load_state = LOAD_STATE_INPUT;
+        }
+        break;
+    case LOAD_STATE_INPUT:
+        /* Input the lines due by now, from the first one on */
+        due = load_run.rate == 0
+                ? load_lines
+                : (uint64_t)(timer_ticks - load_start_ticks) *
+                  load_run.rate / TIMER_HZ + 1;
+        if (due > load_lines) {
+            due = load_lines;
+        }
+        while (load_run.lines < due) {
+            if (!load_line_put()) {
+                /* Count the lines falling behind the rate once */
+                if (load_run.rate != 0 && !load_stalled) {
+                    load_run.stalls++;
+                }
+                load_stalled = true;
+                break;
+            }
+            load_stalled = false;
+        }
+        if (load_run.lines >= load_lines) {
+            load_input_end();
+        }
+        break;
+    case LOAD_STATE_DRAIN:
+        if ((int32_t)(lines_count_out - load_end_count) >= 0 &&
+            output_printer_is_idle()) {
+            load_run.ticks = timer_ticks - load_start_ticks;
+            load_run.busy_ticks = printer_busy_total - load_start_busy;
+            load_run.tx_bytes = printer_tx_total - load_start_tx;
+            load_run.baud = printer_get_baud();
+            load_report = load_run;
+            load_run_count++;
+            load_state = LOAD_STATE_IDLE;
+        }
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
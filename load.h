@@ -0,0 +1,112 @@
+/*
+ * Synthetic line load generator, for measuring print throughput
+ */
+
+#ifndef _LOAD_H
+#define _LOAD_H
+
+#include "timer.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Synthetic line pattern */
+enum load_pattern {
+    /* Blank lines, only fed */
+    LOAD_PATTERN_BLANK,
+    /* Rows of eight-line characters, with spaces and blank margins */
+    LOAD_PATTERN_TEXT,
+    /* Single-dot checkerboard */
+    LOAD_PATTERN_CHECKER,
+    /* All dots black */
+    LOAD_PATTERN_SOLID,
+    /* Number of patterns */
+    LOAD_PATTERN_NUM
+};
+
+/** Pattern names, indexed by enum load_pattern */
+extern const char *const load_pattern_names[LOAD_PATTERN_NUM];
+
+/** Number of lines input by a run by default */
+#define LOAD_LINES_DEFAULT  1000
+
+/** Maximum line rate of a run, lines per second, a line per tick */
+#define LOAD_RATE_MAX       TIMER_HZ
+
+/** Results of a load run */
+struct load_report {
+    /* The pattern of the lines input */
+    enum load_pattern pattern;
+    /* Requested line rate, lines per second, zero for as fast as possible */
+    uint32_t rate;
+    /* Number of lines input */
+    uint32_t lines;
+    /* Timer ticks from the first line input, to the last one printed */
+    uint32_t ticks;
+    /* Timer ticks the printer was busy for */
+    uint32_t busy_ticks;
+    /* Number of bytes transmitted to the printer */
+    uint32_t tx_bytes;
+    /* The printer baud rate */
+    uint32_t baud;
+    /* Maximum number of lines waiting in the line ring buffer */
+    uint32_t queue_max;
+    /*
+     * Number of times the input fell behind the requested rate, as the
+     * line ring buffer was full, zero if inputting as fast as possible
+     */
+    uint32_t stalls;
+};
+
+/** Results of the last finished run, valid if load_run_count is not zero */
+extern struct load_report load_report;
+
+/** Number of runs finished */
+extern volatile uint32_t load_run_count;
+
+/**
+ * Find a pattern by name.
+ *
+ * @param name  The pattern name.
+ *
+ * @return The pattern, or LOAD_PATTERN_NUM if not found.
+ */
+extern enum load_pattern load_pattern_find(const char *name);
+
+/**
+ * Start a load run: once the printer is ready, and the line ring buffer
+ * is free, input a job of synthetic lines in place of the inputs, at a
+ * steady rate, then wait for them to print and record the results. The
+ * other inputs are held off until the job ends.
+ *
+ * @param pattern   The pattern of the lines to input.
+ * @param rate      Number of lines to input per second, 1 to
+ *                  LOAD_RATE_MAX, or zero to input them as fast as the
+ *                  output takes them.
+ * @param lines     Number of lines to input, non-zero.
+ *
+ * @return True if the run started, false if another one is in progress.
+ */
+extern bool load_start(enum load_pattern pattern,
+                       uint32_t rate, uint32_t lines);
+
+/**
+ * Stop the run in progress, if any, ending its job early, and recording
+ * the results once the lines input so far are printed.
+ */
+extern void load_stop(void);
+
+/**
+ * Check if a run is in progress.
+ *
+ * @return True if a run is in progress.
+ */
+extern bool load_is_running(void);
+
+/**
+ * Input the lines due and track the run progress. Never blocks. Must be
+ * called at least every timer tick while a run is in progress, for
+ * accurate rates.
+ */
+extern void load_poll(void);
+
+#endif /* _LOAD_H */
@@ -0,0 +1,136 @@
+/*
+ * Output backends
+ */
+
+#include "output.h"
+#include "lines.h"
+#include <misc.h>
+#include <string.h>
+
+/** The list of added backends */
+static struct output *output_list = NULL;
+
+void
+output_add(struct output *output)
+{
+    assert(output != NULL);
+    assert(output->ready != NULL);
+    assert(output->put != NULL);
+    output->enabled = false;
+    output->count = 0;
+    output->job = 0;
+    output->dropped = 0;
+    output->next = output_list;
+    output_list = output;
+}
+
+void
+output_set_enabled(struct output *output, bool enabled)
+{
+    assert(output != NULL);
+    if (enabled && !output->enabled) {
+        /* Start with the next line and job */
+        output->count = lines_count_in;
+        output->job = lines_job_count;
+    }
+    output->enabled = enabled;
+}
+
+/**
+ * Check if a backend has received all lines of the next job, and so
+ * should receive its end.
+ *
+ * @param output    The backend to check.
+ *
+ * @return True if the job end should be passed to the backend.
+ */
+static bool
+output_job_end_is_due(struct output *output)
+{
+    uint32_t job_count = lines_job_count;
+
+    /* Skip the job ends no longer recorded */
+    if (job_count - output->job > LINES_JOB_NUM) {
+        output->job = job_count - LINES_JOB_NUM;
+    }
+    return output->job != job_count &&
+           (int32_t)(output->count -
+                     lines_job_line_count[output->job &
+                                          (LINES_JOB_NUM - 1)]) >= 0;
+}
+
+bool
+output_poll(void)
+{
+    bool passed = false;
+    uint32_t count_in = lines_count_in;
+    /* The oldest line still needed by a lossless backend */
+    uint32_t count_out = count_in;
+    struct output *output;
+
+    assert(lines_buf != NULL);
+
+    for (output = output_list; output != NULL; output = output->next) {
+        if (output->poll != NULL) {
+            output->poll();
+        }
+        if (!output->enabled) {
+            continue;
+        }
+        /*
+         * If a lossy backend fell behind the slots the input may be
+         * reusing, skip to the oldest line safe to read, leaving one slot
+         * of margin for the line being input.
+         */
+        if (output->lossy &&
+            count_in - output->count > lines_num - 2) {
+            uint32_t count = count_in - (lines_num - 2);
+            output->dropped += count - output->count;
+            output->count = count;
+        }
+        /* Pass all the lines and job ends the backend is ready for */
+        while (output->ready()) {
+            if (output_job_end_is_due(output)) {
+                if (output->end != NULL) {
+                    output->end();
+                }
+                output->job++;
+            } else if (output->count != count_in) {
+                uint32_t slot = output->count & (lines_num - 1);
+                output->put((const uint8_t *)lines_buf +
+                                slot * LINES_LINE_SIZE,
+                            (const struct linemeta *)lines_meta + slot);
+                output->count++;
+                passed = true;
+            } else {
+                break;
+            }
+        }
+        if (!output->lossy &&
+            count_in - output->count > count_in - count_out) {
+            count_out = output->count;
+        }
+    }
+
+    /* Release the line slots no longer needed */
+    lines_count_out = count_out;
+
+    return passed;
+}
+
+size_t
+output_format_line(enum output_format format,
+                   uint8_t *buf,
+                   const uint8_t *line)
+{
+    /* Header of a single-line PBM image of LINES_LINE_LEN dots */
+    static const char pbm_header[] = "P4\n256 1\n";
+    size_t len = 0;
+
+    if (format == OUTPUT_FORMAT_PBM) {
+        len = sizeof(pbm_header) - 1;
+        memcpy(buf, pbm_header, len);
+    }
+    memcpy(buf + len, line, LINES_LINE_SIZE);
+    return len + LINES_LINE_SIZE;
+}
@@ -0,0 +1,203 @@
+/*
+ * Output backends
+ */
+
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include "conv.h"
+#include "linemeta.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Line stream format, for backends streaming raw lines */
+enum output_format {
+    /* Bare line bytes, as captured */
+    OUTPUT_FORMAT_RAW,
+    /* Each line framed as a one-line binary PBM (P4) image */
+    OUTPUT_FORMAT_PBM,
+};
+
+/** Maximum size of a formatted line, bytes */
+#define OUTPUT_FORMAT_MAX_SIZE  48
+
+/**
+ * An output backend, consuming captured lines.
+ *
+ * Each backend reads the line ring buffer at its own pace. A lossless
+ * backend holds up the input until it consumes a line, a lossy one is made
+ * to skip the lines it didn't manage to consume before the input needed
+ * their slots. Neither ever waits for another backend.
+ */
+struct output {
+    /** Backend name */
+    const char *name;
+    /**
+     * True if the backend can skip lines it's not ready for, false if the
+     * input has to wait for it.
+     */
+    bool lossy;
+    /**
+     * Check if the backend can accept another line without blocking.
+     *
+     * @return True if the backend is ready.
+     */
+    bool (*ready)(void);
+    /**
+     * Accept a line. Only called after ready() returned true.
+     * Must not block.
+     *
+     * @param line  The line, LINES_LINE_SIZE bytes.
+     * @param meta  The line's metadata.
+     */
+    void (*put)(const uint8_t *line, const struct linemeta *meta);
+    /**
+     * Accept the end of a job, after its last line. Only called after
+     * ready() returned true. Must not block. Can be NULL.
+     */
+    void (*end)(void);
+    /**
+     * Do the backend's background work, if any. Can be NULL.
+     */
+    void (*poll)(void);
+
+    /*
+     * Dispatcher state, initialized by output_add().
+     */
+    /** True if the backend is receiving lines */
+    bool enabled;
+    /** Number of the next line to pass to the backend */
+    uint32_t count;
+    /** Number of the next job end to pass to the backend */
+    uint32_t job;
+    /** Number of lines skipped by a lossy backend */
+    uint32_t dropped;
+    /** Next added backend */
+    struct output *next;
+};
+
+/** Thermal printer backend */
+extern struct output output_printer;
+
+/**
+ * Maximum number of core clock cycles the printer backend spent producing
+ * a converted printer line. Must stay well below the time it takes to
+ * transmit and print one.
+ */
+extern volatile uint32_t output_printer_conv_cycles_max;
+
+/**
+ * Set the printer backend's line conversion mode, discarding anything
+ * collected so far. Must be called before enabling the backend.
+ *
+ * @param mode  The conversion mode to use.
+ */
+extern void output_printer_set_mode(enum conv_mode mode);
+
+/**
+ * Enable or disable printing the recurring glyphs of the printer backend's
+ * scaled lines as cached user-defined characters, see conv_set_glyphs().
+ * Applies between jobs. Kept across mode changes, disabled initially.
+ *
+ * @param enabled   True to enable the glyph cache, false to disable.
+ */
+extern void output_printer_set_glyphs(bool enabled);
+
+/**
+ * Get the printer backend's glyph cache statistics, since the last mode
+ * change.
+ *
+ * @return The statistics.
+ */
+extern const struct conv_glyph_stats *output_printer_glyph_stats(void);
+
+/**
+ * Check if the printer backend has printed everything it received, up to
+ * the end of the last job, and the printer has finished printing it.
+ *
+ * @return True if the printer backend is idle.
+ */
+extern bool output_printer_is_idle(void);
+
+/**
+ * Reprint a job kept in the history, holding off the captured lines until
+ * it's done. Only starts between jobs, when the backend has received the
+ * end of every job it received lines of.
+ *
+ * @param age   Age of the job to reprint: zero for the most recent one.
+ *
+ * @return True if the reprint started, false if the backend is in the
+ *         middle of a job, or a reprint is in progress, or there's no such
+ *         job.
+ */
+extern bool output_printer_reprint(unsigned int age);
+
+/**
+ * Job history recording backend. Holds off the input while a job is being
+ * reprinted.
+ */
+extern struct output output_history;
+
+/** USB CDC streaming backend */
+extern struct output output_usbcdc;
+
+/**
+ * Set the format of the lines streamed by the USB CDC backend.
+ *
+ * @param format    The format to use, OUTPUT_FORMAT_PBM by default.
+ */
+extern void output_usbcdc_set_format(enum output_format format);
+
+/** File backend, for host builds */
+extern struct output output_file;
+
+/**
+ * Set the file the file backend writes lines to.
+ *
+ * @param fd        The file descriptor to write to, or negative to discard
+ *                  the lines. Writing stops on the first error.
+ * @param format    The format to write the lines in.
+ */
+extern void output_file_open(int fd, enum output_format format);
+
+/**
+ * Add a backend to the dispatcher, disabled.
+ *
+ * @param output    The backend to add.
+ */
+extern void output_add(struct output *output);
+
+/**
+ * Enable or disable passing lines to a backend. A backend starts with the
+ * next line input after it's enabled.
+ *
+ * @param output    The backend to enable or disable.
+ * @param enabled   True to enable the backend, false to disable.
+ */
+extern void output_set_enabled(struct output *output, bool enabled);
+
+/**
+ * Pass lines from the line ring buffer to the backends ready for them, and
+ * let the backends do their background work. Never blocks. Requires the
+ * line ring buffer initialized.
+ *
+ * @return True if any lines were passed, false otherwise.
+ */
+extern bool output_poll(void);
+
+/**
+ * Format a line for a streaming backend.
+ *
+ * @param format    The format to use.
+ * @param buf       The buffer to put the formatted line into,
+ *                  at least OUTPUT_FORMAT_MAX_SIZE bytes.
+ * @param line      The line to format, LINES_LINE_SIZE bytes.
+ *
+ * @return Size of the formatted line, bytes.
+ */
+extern size_t output_format_line(enum output_format format,
+                                 uint8_t *buf,
+                                 const uint8_t *line);
+
+#endif /* _OUTPUT_H */
@@ -0,0 +1,64 @@
+/*
+ * File output backend, for host builds
+ */
+
+#include "output.h"
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+/** The file descriptor to write to, negative if none */
+static int output_file_fd = -1;
+
+/** Format of the lines written */
+static enum output_format output_file_format;
+
+void
+output_file_open(int fd, enum output_format format)
+{
+    output_file_fd = fd;
+    output_file_format = format;
+}
+
+static bool
+output_file_ready(void)
+{
+    struct pollfd pfd = {.fd = output_file_fd, .events = POLLOUT};
+    /* Lines are discarded when there is no file */
+    return output_file_fd < 0 || poll(&pfd, 1, 0) != 0;
+}
+
+static void
+output_file_put(const uint8_t *line, const struct linemeta *meta)
+{
+    uint8_t buf[OUTPUT_FORMAT_MAX_SIZE];
+    size_t len;
+    size_t off;
+    ssize_t rc;
+
+    /* Only dots are written */
+    if (output_file_fd < 0 || (meta->flags & LINEMETA_FLAG_TEXT)) {
+        return;
+    }
+    len = output_format_line(output_file_format, buf, line);
+    /* Ready for writing guarantees a line fits without blocking */
+    for (off = 0; off < len; off += rc) {
+        rc = write(output_file_fd, buf + off, len - off);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                rc = 0;
+                continue;
+            }
+            /* Stop writing on errors, e.g. a closed pipe */
+            output_file_fd = -1;
+            return;
+        }
+    }
+}
+
+struct output output_file = {
+    .name = "file",
+    .lossy = true,
+    .ready = output_file_ready,
+    .put = output_file_put,
+};
@@ -0,0 +1,37 @@
+/*
+ * Job history recording output backend
+ */
+
+#include "output.h"
+#include "history.h"
+#include "lines.h"
+
+_Static_assert(HISTORY_LINE_SIZE == LINES_LINE_SIZE,
+               "History lines don't match captured lines");
+
+static bool
+output_history_ready(void)
+{
+    /* Hold off recording while replaying, not to evict the job replayed */
+    return !history_is_replaying();
+}
+
+static void
+output_history_put(const uint8_t *line, const struct linemeta *meta)
+{
+    history_put(line, meta);
+}
+
+static void
+output_history_end(void)
+{
+    history_end();
+}
+
+struct output output_history = {
+    .name = "history",
+    .lossy = false,
+    .ready = output_history_ready,
+    .put = output_history_put,
+    .end = output_history_end,
+};
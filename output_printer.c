@@ -0,0 +1,164 @@
+/*
+ * Thermal printer output backend
+ */
+
+#include "output.h"
+#include "conv.h"
+#include "printer.h"
+#include "history.h"
+#include "lines.h"
+#include "dwt.h"
+
+_Static_assert(CONV_IN_SIZE == LINES_LINE_SIZE,
+               "Conversion input doesn't match captured lines");
+_Static_assert(CONV_OUT_SIZE == PRINTER_LINE_SIZE,
+               "Conversion output doesn't match printer lines");
+_Static_assert(CONV_FEED_MAX <= PRINTER_FEED_MAX,
+               "Conversion feeds exceed printer feeds");
+_Static_assert(CONV_IN_SIZE <= PRINTER_TEXT_MAX,
+               "Text lines exceed printer text lines");
+_Static_assert(CONV_GLYPH_SIZE == PRINTER_GLYPH_SIZE,
+               "Conversion glyphs don't match printer glyphs");
+
+/** Conversion of captured lines to printer lines */
+static struct conv output_printer_conv;
+
+/** True if the recurring glyphs are printed as user-defined characters */
+static bool output_printer_glyphs;
+
+/** True if the backend received lines of a job, but not its end yet */
+static bool output_printer_in_job;
+
+/** True if the conversion had nothing left to print, last time it was asked */
+static bool output_printer_drained = true;
+
+/** Maximum number of cycles spent retrieving a converted line */
+volatile uint32_t output_printer_conv_cycles_max;
+
+void
+output_printer_set_mode(enum conv_mode mode)
+{
+    conv_init(&output_printer_conv, mode);
+    conv_set_glyphs(&output_printer_conv, output_printer_glyphs);
+    output_printer_in_job = false;
+}
+
+void
+output_printer_set_glyphs(bool enabled)
+{
+    output_printer_glyphs = enabled;
+    conv_set_glyphs(&output_printer_conv, enabled);
+}
+
+const struct conv_glyph_stats *
+output_printer_glyph_stats(void)
+{
+    return &output_printer_conv.glyph_stats;
+}
+
+bool
+output_printer_reprint(unsigned int age)
+{
+    return !output_printer_in_job && history_replay_start(age);
+}
+
+/**
+ * Feed the next line of the job being reprinted to the conversion, or its
+ * end, if the conversion is ready.
+ */
+static void
+output_printer_replay(void)
+{
+    uint8_t line[HISTORY_LINE_SIZE];
+    struct linemeta meta;
+
+    if (!conv_is_ready(&output_printer_conv)) {
+        return;
+    }
+    if (history_replay_next(line, &meta)) {
+        conv_put(&output_printer_conv, line, &meta);
+    } else {
+        conv_end(&output_printer_conv);
+    }
+    output_printer_drained = false;
+}
+
+/**
+ * Send the next converted operation to the printer, if both are ready.
+ */
+static void
+output_printer_poll(void)
+{
+    uint32_t cycles;
+    struct conv_op op;
+    bool got;
+
+    if (history_is_replaying()) {
+        output_printer_replay();
+    }
+    if (!printer_is_ready()) {
+        return;
+    }
+
+    cycles = dwt_cycles();
+    got = conv_get(&output_printer_conv, &op);
+    cycles = dwt_cycles() - cycles;
+    if (cycles > output_printer_conv_cycles_max) {
+        output_printer_conv_cycles_max = cycles;
+    }
+
+    if (!got) {
+        output_printer_drained = true;
+        return;
+    } else if (op.type == CONV_OP_FEED) {
+        printer_feed(op.len);
+    } else if (op.type == CONV_OP_TEXT) {
+        printer_print_text(op.line, op.len);
+    } else if (op.type == CONV_OP_GLYPH) {
+        printer_define_glyph(op.code, op.line);
+    } else if (op.type == CONV_OP_GLYPH_LINE) {
+        printer_print_glyphs(op.line, op.len);
+    } else {
+        printer_print_line(op.line, op.len);
+    }
+}
+
+static bool
+output_printer_ready(void)
+{
+    return !history_is_replaying() && conv_is_ready(&output_printer_conv);
+}
+
+static void
+output_printer_put(const uint8_t *line, const struct linemeta *meta)
+{
+    conv_put(&output_printer_conv, line, meta);
+    output_printer_in_job = true;
+    output_printer_drained = false;
+    output_printer_poll();
+}
+
+static void
+output_printer_end(void)
+{
+    conv_end(&output_printer_conv);
+    output_printer_in_job = false;
+    output_printer_drained = false;
+    output_printer_poll();
+}
+
+bool
+output_printer_is_idle(void)
+{
+    return !output_printer_in_job && !history_is_replaying() &&
+           output_printer_drained && printer_is_ready();
+}
+
+struct output output_printer = {
+    .name = "printer",
+    .lossy = false,
+    .ready = output_printer_ready,
+    .put = output_printer_put,
+    .end = output_printer_end,
+    .poll = output_printer_poll,
+};
@@ -0,0 +1,41 @@
+/*
+ * USB CDC streaming output backend
+ */
+
+#include "output.h"
+#include "usbcdc.h"
+
+/** Format of the lines streamed to the host */
+static enum output_format output_usbcdc_format = OUTPUT_FORMAT_PBM;
+
+void
+output_usbcdc_set_format(enum output_format format)
+{
+    output_usbcdc_format = format;
+}
+
+static bool
+output_usbcdc_ready(void)
+{
+    /* Lines are discarded when the port is closed */
+    return !usbcdc_is_open() || usbcdc_space() >= OUTPUT_FORMAT_MAX_SIZE;
+}
+
+static void
+output_usbcdc_put(const uint8_t *line, const struct linemeta *meta)
+{
+    uint8_t buf[OUTPUT_FORMAT_MAX_SIZE];
+
+    /* Only dots are streamed */
+    if (usbcdc_is_open() && !(meta->flags & LINEMETA_FLAG_TEXT)) {
+        usbcdc_write(buf, output_format_line(output_usbcdc_format,
+                                             buf, line));
+    }
+}
+
+struct output output_usbcdc = {
+    .name = "usbcdc",
+    .lossy = true,
+    .ready = output_usbcdc_ready,
+    .put = output_usbcdc_put,
+};
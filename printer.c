@@ -2,6 +2,10 @@
  * Thermal printer module
  */
 #include "printer.h"
+#include "escpos.h"
+#include "timer.h"
+#include "dwt.h"
+#include "irq.h"
 #include <gpio.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -9,17 +13,54 @@
 /** The USART connected to the printer */
 static volatile struct usart *printer_usart = NULL;
 
-/** The timer used to trigger printer communication */
-static volatile struct tim *printer_tim = NULL;
+/**
+ * Time to consider printer busy after last busy current was seen,
+ * timer ticks, at most. Read by the ADC handler.
+ */
+static volatile uint32_t printer_busy_ticks = PRINTER_BUSY_TICKS_DEFAULT;
+
+/** Frequency of the clock fed to the USART, Hz */
+static uint32_t printer_usart_pclk;
+
+/** The USART baud rate to switch to before transmitting, or zero if none */
+static volatile uint32_t printer_baud_pending;
 
-/** True if the timer is running, false otherwise */
-static volatile bool printer_tim_running;
+/** Heating configuration: max heated dots, time, and interval */
+static uint8_t printer_heat[3] = {
+    ESCPOS_HEAT_DOTS_DEFAULT,
+    ESCPOS_HEAT_TIME_DEFAULT,
+    ESCPOS_HEAT_INTERVAL_DEFAULT,
+};
+
+/** True if the heating configuration should be sent before the next line */
+static bool printer_heat_pending;
+
+/*
+ * Read and written by the main thread and the timer and ADC handlers,
+ * read by users.
+ */
+/** Number of lines printed */
+volatile uint32_t printer_line_count;
+/** Number of blank dot lines fed */
+volatile uint32_t printer_feed_count;
+/** Number of timer ticks the printer was busy while operating */
+volatile uint32_t printer_busy_total;
+/** Number of bytes transmitted to the printer */
+volatile uint32_t printer_tx_total;
+/** Tick count the printer was last set busy at */
+static volatile uint32_t printer_busy_since;
+
+/** The timer clearing the busy flag after the busy current is gone */
+static struct timer printer_busy_timer;
+
+/** The timer driving the initialization steps */
+static struct timer printer_init_timer;
 
 /**
- * Time to consider printer busy after last busy current was seen,
- * tenths of milliseconds.
+ * Ticks to wait after the current transmission completes, before the next
+ * initialization step
  */
-static const uint16_t printer_busy_time_ms_div_10 = 1;
+static uint32_t printer_init_wait;
 
 /** The GPIO port used to output printer busy status */
 static volatile struct gpio *printer_busy_gpio = NULL;
@@ -42,26 +83,62 @@ static volatile unsigned int printer_adc_current_idle = 0;
 /** Maximum printer feed current */
 static volatile unsigned int printer_adc_current_feed = 0;
 
-/** Printer state. Modified by printer_init() */
-static volatile enum {
+/**
+ * Buffer holding the data being transmitted to the printer: a line, a
+ * text or glyph line, a glyph definition, or a feed, possibly preceded by
+ * a configuration command
+ */
+static uint8_t printer_tx_buf[ESCPOS_CONFIG_SIZE +
+                              ESCPOS_LINE_SIZE(PRINTER_LINE_SIZE)];
+
+_Static_assert(ESCPOS_TEXT_SIZE(PRINTER_TEXT_MAX) <=
+               ESCPOS_LINE_SIZE(PRINTER_LINE_SIZE),
+               "Text line doesn't fit the transmission buffer");
+_Static_assert(ESCPOS_GLYPH_LINE_SIZE(PRINTER_TEXT_MAX) <=
+               ESCPOS_LINE_SIZE(PRINTER_LINE_SIZE) &&
+               ESCPOS_GLYPH_DEFINE_SIZE <=
+               ESCPOS_LINE_SIZE(PRINTER_LINE_SIZE),
+               "Glyphs don't fit the transmission buffer");
+
+/** Pointer to the next byte to transmit, updated by the USART handler */
+static const uint8_t * volatile printer_tx_ptr = printer_tx_buf;
+
+/** Pointer to the end of the data to transmit */
+static const uint8_t * volatile printer_tx_end = printer_tx_buf;
+
+/** Printer state */
+enum printer_state {
+    /* Powering up */
+    PRINTER_STATE_POWERING_UP,
     /* Initializing */
     PRINTER_STATE_INITIALIZING,
+    /* Configuring */
+    PRINTER_STATE_CONFIGURING,
     /* Measuring idle current */
     PRINTER_STATE_MEASURING_CURRENT_IDLE,
     /* Measuring feed current */
     PRINTER_STATE_MEASURING_CURRENT_FEED,
     /* Operating */
     PRINTER_STATE_OPERATING,
-} printer_state;
+};
+
+/** Printer state. Modified by the initialization steps */
+static volatile enum printer_state printer_state;
 
 /**
  * Set printer busy status.
  *
  * @param busy  The status to set.
  */
-static void
+static RAMFUNC void
 printer_set_busy(bool busy)
 {
+    if (busy && !printer_busy) {
+        printer_busy_since = timer_ticks;
+    } else if (!busy && printer_busy &&
+               printer_state == PRINTER_STATE_OPERATING) {
+        printer_busy_total += timer_ticks - printer_busy_since;
+    }
     printer_busy = busy;
     gpio_pin_set(printer_busy_gpio, printer_busy_pin, printer_busy);
 }
@@ -78,84 +155,18 @@ printer_is_busy(void)
 }
 
 /**
- * Initialize the printer timer.
- *
- * @param tim       The timer to use. Must be reset. Will be configured for
- *                  operation. The printer_tim_handler() function should be
- *                  arranged to be called for the specified timer's
- *                  interrupts.
- * @param ck_int    Frequency of the clock fed to the timer (CK_INT).
- */
-static void
-printer_tim_init(volatile struct tim *tim, uint32_t ck_int)
-{
-    assert(printer_tim == NULL);
-    printer_tim = tim;
-    /* Setup counting in 1/10th of milliseconds */
-    printer_tim->psc = ck_int / 10000;
-    /* Select downcounting, enable auto-reload preload */
-    printer_tim->cr1 = (printer_tim->cr1 & ~TIM_CR1_DIR_MASK) |
-                       (TIM_CR1_DIR_VAL_DOWN << TIM_CR1_DIR_LSB) |
-                       TIM_CR1_ARPE_MASK;
-    /* Enable Capture/Compare 1 interrupt */
-    printer_tim->dier |= TIM_DIER_CC1IE_MASK;
-    /* Mark non-running */
-    printer_tim_running = false;
-}
-
-/**
- * Schedule a timer for specified amount of time.
+ * Clear the busy flag once the busy current is gone for a while.
  *
- * @param ms_div_10 The time to schedule the timer for, tenths of millisecond.
+ * @param data  Not used.
  */
 static void
-printer_tim_schedule(uint16_t ms_div_10)
-{
-    assert(printer_tim != NULL);
-
-    /* Set time to count */
-    printer_tim->arr = ms_div_10;
-    /* Generate an update event to transfer data to shadow registers */
-    printer_tim->egr |= TIM_EGR_UG_MASK;
-    /* Mark timer as running */
-    printer_tim_running = true;
-    /* Start counting */
-    printer_tim->cr1 |= TIM_CR1_CEN_MASK | TIM_CR1_OPM_MASK;
-}
-
-void
-printer_tim_handler(void)
+printer_busy_timeout(void *data)
 {
-    assert(printer_tim != NULL);
-    assert(printer_tim_running = true);
-
-    if (printer_tim->sr & TIM_SR_CC1IF_MASK) {
-        /* If we're operating */
-        if (printer_state == PRINTER_STATE_OPERATING) {
-            /* Free up the printer */
-            printer_set_busy(false);
-        }
-    }
-
-    /* Mark timer as not running */
-    printer_tim_running = false;
-    /* Clear the interrupt flags */
-    printer_tim->sr = 0;
-}
-
-/**
- * Sleep for specified time using printer timer.
- *
- * @param ms_div_10 The time to sleep for, tenths of millisecond.
- */
-static void
-printer_tim_sleep(uint16_t ms_div_10)
-{
-    assert(printer_tim != NULL);
-    assert(printer_tim_running == false);
-    printer_tim_schedule(ms_div_10);
-    while (printer_tim_running) {
-        asm("wfi");
+    (void)data;
+    /* If we're operating */
+    if (printer_state == PRINTER_STATE_OPERATING) {
+        /* Free up the printer */
+        printer_set_busy(false);
     }
 }
 
@@ -173,7 +184,7 @@ printer_adc_init(volatile struct adc *adc, unsigned int adc_chan)
     printer_adc_chan = adc_chan;
 }
 
-void
+RAMFUNC void
 printer_adc_handler(void)
 {
     unsigned int sr;
@@ -189,8 +200,12 @@ printer_adc_handler(void)
         if (printer_state == PRINTER_STATE_OPERATING) {
             /* Set the busy flag */
             printer_set_busy(true);
-            /* Prime the timer to clear busy flag */
-            printer_tim_schedule(printer_busy_time_ms_div_10);
+            /*
+             * Prime the timer to clear busy flag, started between ticks,
+             * so after more than printer_busy_ticks - 1 and at most
+             * printer_busy_ticks
+             */
+            timer_start(&printer_busy_timer, printer_busy_ticks - 1, 0);
         }
         /* Clear the analog watchdog flag */
         printer_adc->sr &= ~ADC_SR_AWD_MASK;
@@ -224,11 +239,7 @@ printer_adc_continuous_start(void)
     /* Power up the ADC by setting the ADON bit */
     printer_adc->cr2 |= ADC_CR2_ADON_MASK;
     /* Wait for ADC to stabilize */
-    {
-        volatile unsigned int i;
-        /* At least 1us at 72MHz, considering 2 cycles per loop */
-        for (i = 0; i < 36; i++);
-    }
+    dwt_delay_us(1);
     /* Set channel sampling time */
     adc_channel_set_sample_time(printer_adc, printer_adc_chan,
                                 ADC_SMPRX_SMPX_VAL_28_5C);
@@ -274,11 +285,7 @@ printer_adc_watchdog_start(unsigned int low, unsigned int high)
     /* Power up the ADC by setting the ADON bit */
     printer_adc->cr2 |= ADC_CR2_ADON_MASK;
     /* Wait for ADC to stabilize */
-    {
-        volatile unsigned int i;
-        /* At least 1us at 72MHz, considering 2 cycles per loop */
-        for (i = 0; i < 36; i++);
-    }
+    dwt_delay_us(1);
     /* Set watchdog channel */
     printer_adc->cr1 = (printer_adc->cr1 & ~ADC_CR1_AWDCH_MASK) |
                        (printer_adc_chan << ADC_CR1_AWDCH_LSB);
@@ -298,99 +305,298 @@ printer_adc_watchdog_start(unsigned int low, unsigned int high)
 }
 
 /**
- * Transmit data to the printer, putting it into busy state.
+ * Check if a transmission to the printer is in progress.
  *
- * @param ptr               Pointer to the data to transmit.
- * @param len               Length of the data to transmit, bytes.
+ * @return True if the transmission is in progress.
+ */
+static bool
+printer_tx_is_active(void)
+{
+    return printer_tx_ptr < printer_tx_end ||
+           /* Let the last byte out before switching the baud rate */
+           (printer_baud_pending != 0 &&
+            !(printer_usart->sr & USART_SR_TC_MASK));
+}
+
+/**
+ * Apply the pending baud rate change, if any, and put the pending heating
+ * configuration command, if any, at the start of the transmission buffer.
+ * Must only be called when no transmission is active.
+ *
+ * @return Number of bytes put into the transmission buffer.
+ */
+static size_t
+printer_tx_prologue(void)
+{
+    uint32_t baud = printer_baud_pending;
+
+    assert(!printer_tx_is_active());
+
+    if (baud != 0) {
+        printer_usart->brr = (printer_usart_pclk + baud / 2) / baud;
+        printer_baud_pending = 0;
+    }
+    if (printer_heat_pending) {
+        printer_heat_pending = false;
+        return escpos_config(printer_tx_buf, printer_heat[0],
+                             printer_heat[1], printer_heat[2]);
+    }
+    return 0;
+}
+
+/**
+ * Start transmitting the data from the transmission buffer to the printer,
+ * without waiting for it to complete. The printer_usart_handler() will
+ * feed the USART from the buffer.
+ *
+ * @param len   Length of the data in printer_tx_buf to transmit, bytes.
  */
 static void
-printer_transmit(const void *ptr, size_t len)
+printer_tx_start(size_t len)
+{
+    assert(printer_usart != NULL);
+    assert(!printer_tx_is_active());
+    assert(len <= sizeof(printer_tx_buf));
+
+    printer_tx_ptr = printer_tx_buf;
+    printer_tx_end = printer_tx_buf + len;
+    printer_tx_total += len;
+    /* Enable "transmit data register empty" interrupt */
+    printer_usart->cr1 |= USART_CR1_TXEIE_MASK;
+}
+
+void
+printer_usart_handler(void)
 {
     assert(printer_usart != NULL);
 
-    /* Wait for the printer to free up */
-    while (printer_is_busy()) {
-        asm("wfi");
+    /* If the transmit data register is empty and we're transmitting */
+    if ((printer_usart->sr & USART_SR_TXE_MASK) &&
+        (printer_usart->cr1 & USART_CR1_TXEIE_MASK)) {
+        const uint8_t *ptr = printer_tx_ptr;
+        if (ptr < printer_tx_end) {
+            printer_usart->dr = *ptr++;
+            printer_tx_ptr = ptr;
+        }
+        /* If we're out of data */
+        if (ptr >= printer_tx_end) {
+            /* Stop the interrupt */
+            printer_usart->cr1 &= ~USART_CR1_TXEIE_MASK;
+        }
+    }
+}
+
+/**
+ * Schedule the next initialization step, after the current transmission
+ * completes and the specified time passes.
+ *
+ * @param state The printer state to enter until the step.
+ * @param ticks The time to wait after the transmission, timer ticks.
+ */
+static void
+printer_init_next(enum printer_state state, uint32_t ticks)
+{
+    printer_state = state;
+    printer_init_wait = ticks;
+    timer_start(&printer_init_timer, 0, 0);
+}
+
+/**
+ * Perform the next printer initialization step, scheduled by
+ * printer_init_next().
+ *
+ * @param data  Not used.
+ */
+static void
+printer_init_step(void *data)
+{
+    (void)data;
+
+    /* Check again on the next tick, if still transmitting */
+    if (printer_tx_is_active()) {
+        timer_start(&printer_init_timer, 0, 0);
+        return;
+    }
+    /*
+     * Wait for the specified time after the transmission, if any,
+     * exactly, as started from the timer's function, on a tick
+     */
+    if (printer_init_wait != 0) {
+        timer_start(&printer_init_timer, printer_init_wait - 1, 0);
+        printer_init_wait = 0;
+        return;
+    }
+
+    switch (printer_state) {
+    case PRINTER_STATE_POWERING_UP:
+        /* Send init command, at the configured baud rate */
+        printer_tx_prologue();
+        printer_tx_start(escpos_reset(printer_tx_buf));
+        printer_init_next(PRINTER_STATE_INITIALIZING, TIMER_MS(500));
+        break;
+    case PRINTER_STATE_INITIALIZING:
+        /* Send configuration command */
+        printer_heat_pending = true;
+        printer_tx_start(printer_tx_prologue());
+        printer_init_next(PRINTER_STATE_CONFIGURING, TIMER_MS(3));
+        break;
+    case PRINTER_STATE_CONFIGURING:
+        /* Measure idle current */
+        printer_adc_continuous_start();
+        printer_init_next(PRINTER_STATE_MEASURING_CURRENT_IDLE,
+                          TIMER_MS(500));
+        break;
+    case PRINTER_STATE_MEASURING_CURRENT_IDLE:
+        /* Measure feed current */
+        printer_tx_start(escpos_feed(printer_tx_buf, 3));
+        printer_init_next(PRINTER_STATE_MEASURING_CURRENT_FEED,
+                          TIMER_MS(500));
+        break;
+    case PRINTER_STATE_MEASURING_CURRENT_FEED:
+        printer_adc_continuous_stop();
+        /* Enable the printer */
+        printer_state = PRINTER_STATE_OPERATING;
+        printer_adc_watchdog_start(0,
+                                   (printer_adc_current_idle +
+                                    printer_adc_current_feed) / 2);
+        printer_set_busy(false);
+        break;
+    default:
+        assert(false);
+        break;
     }
-    /* Send the data */
-    usart_transmit(printer_usart, ptr, len);
-    /* The analog watchdog and the timer will free it up */
 }
 
 void
 printer_init(volatile struct usart *usart,
+             uint32_t pclk,
              volatile struct adc *adc,
              unsigned int adc_chan,
-             volatile struct tim *tim,
-             uint32_t ck_int,
              volatile struct gpio *busy_gpio,
              unsigned int busy_pin)
 {
-    static const uint8_t init_cmd[] = {0x1B, 0x40};
-    static const uint8_t config_cmd[] = {
-        0x1B, 0x37,
-        /* Max simultaneously heated dots, in units of 8 dots minus one */
-        0x02,
-        /* Heating time, in 10us units */
-        0xB0,
-        /* Heating interval, in 10us units */
-        0x0C};
-    static const uint8_t feed_cmd[] = {0x1B, 0x4A, 0x03};
-
     assert(printer_usart == NULL);
 
     /*
      * Initialize the variables
      */
     printer_usart = usart;
+    printer_usart_pclk = pclk;
     printer_busy_gpio = busy_gpio;
     printer_busy_pin = busy_pin;
+    timer_setup(&printer_busy_timer, printer_busy_timeout, NULL);
+    timer_setup(&printer_init_timer, printer_init_step, NULL);
 
     /*
      * Initialize the peripherals
      */
-    printer_tim_init(tim, ck_int);
     printer_adc_init(adc, adc_chan);
 
     /*
-     * Initialize the printer after a power-on
+     * Initialize the printer after a power-on, once the power-up completes
      */
-    printer_state = PRINTER_STATE_INITIALIZING;
-    /* Wait for power-up to complete */
-    printer_tim_sleep(30000);
-    /* Send init command */
-    usart_transmit(printer_usart, init_cmd, sizeof(init_cmd));
-    printer_tim_sleep(5000);
-    /* Send configuration command */
-    usart_transmit(printer_usart, config_cmd, sizeof(config_cmd));
-    printer_tim_sleep(28);
+    printer_init_next(PRINTER_STATE_POWERING_UP, TIMER_MS(3000));
+}
 
-    /*
-     * Measure idle/feed current
-     */
-    printer_state = PRINTER_STATE_MEASURING_CURRENT_IDLE;
-    printer_adc_continuous_start();
-    printer_tim_sleep(5000);
-    printer_state = PRINTER_STATE_MEASURING_CURRENT_FEED;
-    usart_transmit(printer_usart, feed_cmd, sizeof(feed_cmd));
-    printer_tim_sleep(5000);
-    printer_adc_continuous_stop();
+bool
+printer_is_ready(void)
+{
+    return printer_state == PRINTER_STATE_OPERATING &&
+           !printer_is_busy() && !printer_tx_is_active();
+}
 
-    /*
-     * Enable the printer
-     */
-    printer_state = PRINTER_STATE_OPERATING;
-    printer_adc_watchdog_start(0,
-                               (printer_adc_current_idle +
-                                printer_adc_current_feed) / 2);
-    printer_set_busy(false);
+void
+printer_print_line(const uint8_t *line, size_t len)
+{
+    assert(printer_is_ready());
+    assert(len > 0 && len <= PRINTER_LINE_SIZE);
+    size_t size = printer_tx_prologue();
+    /* The analog watchdog and the timer will free it up */
+    printer_set_busy(true);
+    printer_tx_start(size + escpos_line(printer_tx_buf + size, line, len));
+    printer_line_count++;
 }
 
 void
-printer_print_line(const uint8_t *line)
+printer_print_text(const uint8_t *text, size_t len)
 {
-    static const uint8_t image_cmd[] = {0x12, 0x2A, 0x01, 0x30};
-    printer_transmit(image_cmd, sizeof(image_cmd));
-    printer_transmit(line, 0x30);
+    assert(printer_is_ready());
+    assert(len <= PRINTER_TEXT_MAX);
+    size_t size = printer_tx_prologue();
+    /* The analog watchdog and the timer will free it up */
     printer_set_busy(true);
+    printer_tx_start(size + escpos_text(printer_tx_buf + size, text, len));
+    printer_line_count++;
+}
+
+void
+printer_define_glyph(uint8_t code, const uint8_t *glyph)
+{
+    assert(printer_is_ready());
+    assert(code >= ESCPOS_GLYPH_CODE_MIN && code <= ESCPOS_GLYPH_CODE_MAX);
+    size_t size = printer_tx_prologue();
+    /* Nothing is printed, so no current would free up the busy status */
+    printer_tx_start(size + escpos_glyph_define(printer_tx_buf + size,
+                                                code, glyph));
+}
+
+void
+printer_print_glyphs(const uint8_t *codes, size_t len)
+{
+    assert(printer_is_ready());
+    assert(len <= PRINTER_TEXT_MAX);
+    size_t size = printer_tx_prologue();
+    /* The analog watchdog and the timer will free it up */
+    printer_set_busy(true);
+    printer_tx_start(size + escpos_glyph_line(printer_tx_buf + size,
+                                              codes, len));
+    printer_line_count++;
+}
+
+void
+printer_feed(unsigned int lines)
+{
+    assert(printer_is_ready());
+    assert(lines > 0 && lines <= PRINTER_FEED_MAX);
+    size_t size = printer_tx_prologue();
+    /* The analog watchdog and the timer will free it up */
+    printer_set_busy(true);
+    printer_tx_start(size + escpos_feed(printer_tx_buf + size, lines));
+    printer_feed_count += lines;
+}
+
+void
+printer_set_busy_ticks(uint32_t ticks)
+{
+    assert(ticks != 0);
+    printer_busy_ticks = ticks;
+}
+
+void
+printer_set_heat(uint8_t dots, uint8_t time, uint8_t interval)
+{
+    /* Don't let the initialization pick up a partial update */
+    uint32_t basepri = irq_lock();
+    printer_heat[0] = dots;
+    printer_heat[1] = time;
+    printer_heat[2] = interval;
+    /* Configuring state sends it anyway */
+    if (printer_state > PRINTER_STATE_INITIALIZING) {
+        printer_heat_pending = true;
+    }
+    irq_unlock(basepri);
+}
+
+void
+printer_set_baud(uint32_t baud)
+{
+    assert(baud != 0);
+    printer_baud_pending = baud;
+}
+
+uint32_t
+printer_get_baud(void)
+{
+    assert(printer_usart != NULL);
+    return printer_usart_pclk / printer_usart->brr;
 }
@@ -5,61 +5,198 @@
 #ifndef _PRINTER_H
 #define _PRINTER_H
 
+#include "ramfunc.h"
+#include "escpos.h"
 #include <gpio.h>
 #include <usart.h>
-#include <tim.h>
 #include <adc.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+/** Number of dots on a printer line */
+#define PRINTER_LINE_LEN    384
+
+/** Number of bytes in a printer line */
+#define PRINTER_LINE_SIZE   (PRINTER_LINE_LEN / 8)
+
+/**
+ * Default time to consider the printer busy after its busy current is
+ * gone, timer ticks, at most. Matches the original 100us.
+ */
+#define PRINTER_BUSY_TICKS_DEFAULT  1
+
+/** Number of lines printed, dots or text */
+extern volatile uint32_t printer_line_count;
+
+/** Number of blank dot lines fed */
+extern volatile uint32_t printer_feed_count;
+
+/** Number of timer ticks the printer was busy for, once operating */
+extern volatile uint32_t printer_busy_total;
+
+/** Number of bytes transmitted to the printer */
+extern volatile uint32_t printer_tx_total;
 
 /**
  * Initialize the printer module, assuming it's called right after power-on.
+ * Returns right away, the printer initialization continues in the
+ * background, driven by a software timer, until printer_is_ready() returns
+ * true for the first time. Requires the timer module initialized.
  *
  * @param usart     The USART the printer is connected to. Must have line
- *                  parameters configured.
+ *                  parameters configured. The printer_usart_handler()
+ *                  function should be arranged to be called for the
+ *                  specified USART's interrupts.
+ * @param pclk      Frequency of the clock fed to the USART, Hz, for baud
+ *                  rate changes.
  * @param adc       The ADC to use for measuring the printer's current
  *                  consumption, for determining its busy status.
  *                  Must be calibrated and powered down.
  * @param adc_chan  The number of the ADC channel to use for measuring the
  *                  printer's current consumption.
- * @param tim       The timer to use for timing communication with the printer.
- *                  Must be reset. Will be configured for operation.
- *                  The printer_tim_handler() function should be arranged to
- *                  be called for the specified timer's interrupts.
- * @param ck_int    Frequency of the clock fed to the timer (CK_INT).
  * @param busy_gpio The GPIO port used to output the printer busy status.
  * @param busy_pin  The pin on the GPIO port used to output the printer busy
  *                  status.
  */
 extern void printer_init(volatile struct usart *usart,
+                         uint32_t pclk,
                          volatile struct adc *adc,
                          unsigned int adc_chan,
-                         volatile struct tim *tim,
-                         uint32_t ck_int,
                          volatile struct gpio *busy_gpio,
                          unsigned int busy_pin);
 
 /**
- * Printer's timer interrupt handler.
+ * Printer's ADC interrupt handler.
  *
- * Must be called when an interrupt is triggered for the timer passed
+ * Must be called when an interrupt is triggered for the ADC passed
  * previously to printer_init().
  */
-extern void printer_tim_handler(void);
+extern RAMFUNC void printer_adc_handler(void);
 
 /**
- * Printer's ADC interrupt handler.
+ * Printer's USART interrupt handler.
  *
- * Must be called when an interrupt is triggered for the ADC passed
+ * Must be called when an interrupt is triggered for the USART passed
  * previously to printer_init().
  */
-extern void printer_adc_handler(void);
+extern void printer_usart_handler(void);
+
+/**
+ * Check if the printer is ready to accept another line, i.e. it's
+ * initialized, not busy, and not receiving a previous line.
+ *
+ * @return True if the printer is ready.
+ */
+extern bool printer_is_ready(void);
+
+/** Maximum number of characters printed by printer_print_text() */
+#define PRINTER_TEXT_MAX    32
+
+/**
+ * Start printing a line of text with the printer's font, without waiting
+ * for the transmission to complete. Must only be called when
+ * printer_is_ready() returns true.
+ *
+ * @param text  The characters to print, printable ASCII. Copied before
+ *              returning.
+ * @param len   Number of characters, zero to PRINTER_TEXT_MAX. Zero
+ *              feeds an empty text line.
+ */
+extern void printer_print_text(const uint8_t *text, size_t len);
+
+/** Width of a user-defined character glyph, dots */
+#define PRINTER_GLYPH_WIDTH     ESCPOS_GLYPH_WIDTH
+
+/** Height of a user-defined character glyph, dots */
+#define PRINTER_GLYPH_HEIGHT    ESCPOS_GLYPH_HEIGHT
+
+/** Number of bytes in a user-defined character glyph */
+#define PRINTER_GLYPH_SIZE      ESCPOS_GLYPH_SIZE
+
+/**
+ * Start defining the glyph of a user-defined character, without waiting
+ * for the transmission to complete. Must only be called when
+ * printer_is_ready() returns true. Doesn't print anything, and doesn't
+ * make the printer busy.
+ *
+ * @param code  The character code, ESCPOS_GLYPH_CODE_MIN to
+ *              ESCPOS_GLYPH_CODE_MAX.
+ * @param glyph The glyph, PRINTER_GLYPH_SIZE bytes, column by column, left
+ *              to right, each top to bottom, most significant bit first.
+ *              Copied before returning.
+ */
+extern void printer_define_glyph(uint8_t code, const uint8_t *glyph);
+
+/**
+ * Start printing a line of user-defined characters, without waiting for
+ * the transmission to complete, with no spacing between lines. Must only
+ * be called when printer_is_ready() returns true.
+ *
+ * @param codes The character codes. The codes of undefined characters
+ *              print blank. Copied before returning.
+ * @param len   Number of characters, zero to PRINTER_TEXT_MAX.
+ */
+extern void printer_print_glyphs(const uint8_t *codes, size_t len);
+
+/** Maximum number of dot lines fed by printer_feed() */
+#define PRINTER_FEED_MAX    ESCPOS_FEED_MAX
+
+/**
+ * Start printing a line of pixels, without waiting for the transmission to
+ * complete. Must only be called when printer_is_ready() returns true.
+ *
+ * @param line  An array of bytes, where each bit stands for an output dot:
+ *              zero for blank, one for black, for a total of up to
+ *              PRINTER_LINE_LEN dots. Copied before returning.
+ * @param len   Number of bytes in the line, 1 to PRINTER_LINE_SIZE. The
+ *              dots past them are blank.
+ */
+extern void printer_print_line(const uint8_t *line, size_t len);
+
+/**
+ * Start feeding blank dot lines, without waiting for the transmission to
+ * complete. Must only be called when printer_is_ready() returns true.
+ *
+ * @param lines Number of dot lines to feed, 1 to PRINTER_FEED_MAX.
+ */
+extern void printer_feed(unsigned int lines);
+
+/**
+ * Set the time to consider the printer busy after its busy current is
+ * gone. Takes effect with the next busy period.
+ *
+ * @param ticks Number of timer ticks, at least one. The busy flag is
+ *              cleared after more than ticks - 1, and at most ticks.
+ */
+extern void printer_set_busy_ticks(uint32_t ticks);
+
+/**
+ * Set the printer's heating configuration. Sent to the printer during
+ * initialization, or before the next line or feed, if already
+ * initialized.
+ *
+ * @param dots      Max simultaneously heated dots, in units of 8 dots
+ *                  minus one.
+ * @param time      Heating time, in 10us units.
+ * @param interval  Heating interval, in 10us units.
+ */
+extern void printer_set_heat(uint8_t dots, uint8_t time, uint8_t interval);
+
+/**
+ * Set the baud rate of the USART talking to the printer. Takes effect
+ * before the next transmission, once the previous one is out.
+ *
+ * @param baud  The baud rate to set.
+ */
+extern void printer_set_baud(uint32_t baud);
 
 /**
- * Print a line of pixels to the printer.
+ * Get the baud rate of the USART talking to the printer, as currently
+ * configured.
  *
- * @param line  An array of 48 bytes, where each bit stands for an output dot:
- *              zero for blank, one for black, for a total of 384 dots.
+ * @return The baud rate.
  */
-extern void printer_print_line(const uint8_t *line);
+extern uint32_t printer_get_baud(void);
 
 #endif /* _PRINTER_H */
@@ -0,0 +1,20 @@
+/*
+ * Functions executed from RAM
+ */
+
+#ifndef _RAMFUNC_H
+#define _RAMFUNC_H
+
+/**
+ * Place a function into RAM, to run it without flash wait states.
+ *
+ * The function goes into the ".ramfunc" input section of the .data output
+ * section, so the startup code copies it from flash along with the
+ * initialized data. It's always called with a long branch, as RAM is out
+ * of direct branch range from flash, and is never inlined into callers in
+ * flash.
+ */
+#define RAMFUNC \
+    __attribute__ ((section(".data.ramfunc"), long_call, noinline))
+
+#endif /* _RAMFUNC_H */
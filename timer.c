@@ -0,0 +1,158 @@
+/*
+ * Software timers, multiplexed on the SysTick timebase with a hashed
+ * timer wheel
+ */
+
+#include "timer.h"
+#include "irq.h"
+#include <misc.h>
+#include <stddef.h>
+
+/** SysTick control and status register */
+#define TIMER_SYST_CSR  (*(volatile uint32_t *)0xE000E010)
+/** SYST_CSR counter enable bit */
+#define TIMER_SYST_CSR_ENABLE       (1U << 0)
+/** SYST_CSR exception enable bit */
+#define TIMER_SYST_CSR_TICKINT      (1U << 1)
+/** SYST_CSR processor clock source bit */
+#define TIMER_SYST_CSR_CLKSOURCE    (1U << 2)
+
+/** SysTick reload value register */
+#define TIMER_SYST_RVR  (*(volatile uint32_t *)0xE000E014)
+
+/** SysTick current value register */
+#define TIMER_SYST_CVR  (*(volatile uint32_t *)0xE000E018)
+
+volatile uint32_t timer_ticks;
+
+/**
+ * The timer wheel: lists of pending timers, each timer in the slot of its
+ * expiration tick modulo the wheel size. Timers expiring more than a wheel
+ * revolution away stay in their slot until their tick comes.
+ */
+static struct timer *timer_wheel[TIMER_WHEEL_SIZE];
+
+/**
+ * Insert a timer into the wheel slot of its expiration tick.
+ * Must be called within irq_lock().
+ *
+ * @param timer The timer to insert, not pending.
+ */
+static inline __attribute__ ((always_inline)) void
+timer_link(struct timer *timer)
+{
+    struct timer **pslot =
+        &timer_wheel[timer->expires & (TIMER_WHEEL_SIZE - 1)];
+    timer->next = *pslot;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = pslot;
+    *pslot = timer;
+}
+
+/**
+ * Remove a timer from its wheel slot.
+ * Must be called within irq_lock().
+ *
+ * @param timer The timer to remove, pending.
+ */
+static inline __attribute__ ((always_inline)) void
+timer_unlink(struct timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->pprev = NULL;
+}
+
+void
+timer_init(uint32_t core_hz)
+{
+    assert(core_hz / TIMER_HZ - 1 <= 0xFFFFFF);
+    timer_ticks = 0;
+    TIMER_SYST_RVR = core_hz / TIMER_HZ - 1;
+    TIMER_SYST_CVR = 0;
+    TIMER_SYST_CSR = TIMER_SYST_CSR_CLKSOURCE | TIMER_SYST_CSR_TICKINT |
+                     TIMER_SYST_CSR_ENABLE;
+}
+
+void
+timer_setup(struct timer *timer, void (*fn)(void *data), void *data)
+{
+    assert(timer != NULL);
+    assert(fn != NULL);
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->period = 0;
+    timer->fn = fn;
+    timer->data = data;
+}
+
+RAMFUNC void
+timer_start(struct timer *timer, uint32_t delay, uint32_t period)
+{
+    uint32_t basepri;
+
+    assert(timer != NULL);
+    assert(timer->fn != NULL);
+
+    basepri = irq_lock();
+    if (timer_is_pending(timer)) {
+        timer_unlink(timer);
+    }
+    timer->expires = timer_ticks + delay + 1;
+    timer->period = period;
+    timer_link(timer);
+    irq_unlock(basepri);
+}
+
+RAMFUNC void
+timer_stop(struct timer *timer)
+{
+    uint32_t basepri;
+
+    assert(timer != NULL);
+
+    basepri = irq_lock();
+    if (timer_is_pending(timer)) {
+        timer_unlink(timer);
+    }
+    irq_unlock(basepri);
+}
+
+void
+timer_handler(void)
+{
+    uint32_t ticks = timer_ticks + 1;
+    struct timer **pslot = &timer_wheel[ticks & (TIMER_WHEEL_SIZE - 1)];
+    struct timer *timer;
+    uint32_t basepri;
+
+    timer_ticks = ticks;
+
+    /*
+     * Take expired timers off the slot one at a time, rescanning after
+     * each call, as the functions may start and stop timers.
+     */
+    while (true) {
+        basepri = irq_lock();
+        for (timer = *pslot;
+             timer != NULL && timer->expires != ticks;
+             timer = timer->next);
+        if (timer != NULL) {
+            timer_unlink(timer);
+            if (timer->period != 0) {
+                timer->expires += timer->period;
+                timer_link(timer);
+            }
+        }
+        irq_unlock(basepri);
+        if (timer == NULL) {
+            break;
+        }
+        timer->fn(timer->data);
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * Software timers, multiplexed on the SysTick timebase with a hashed
+ * timer wheel
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "ramfunc.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Frequency of timer ticks, Hz */
+#define TIMER_HZ    10000
+
+/** Number of timer ticks in the specified number of milliseconds */
+#define TIMER_MS(_ms)   ((uint32_t)(_ms) * (TIMER_HZ / 1000))
+
+/** Number of timer wheel slots, a power of two */
+#define TIMER_WHEEL_SIZE    64
+
+/**
+ * A software timer. Must be set up with timer_setup() before use, and
+ * must not be modified while pending.
+ */
+struct timer {
+    /* Next timer in the same wheel slot */
+    struct timer *next;
+    /* Pointer to the previous timer's "next", or NULL if not pending */
+    struct timer **pprev;
+    /* Tick count the timer expires at */
+    uint32_t expires;
+    /* Ticks between expirations, or zero for a one-shot timer */
+    uint32_t period;
+    /* Function to call on expiration, from the timer interrupt */
+    void (*fn)(void *data);
+    /* Data to pass to the function */
+    void *data;
+};
+
+/**
+ * Number of timer ticks passed since timer_init(), modulo 2^32.
+ * Updated by timer_handler().
+ */
+extern volatile uint32_t timer_ticks;
+
+/**
+ * Initialize the timer module and start the SysTick timebase.
+ *
+ * @param core_hz   Frequency of the core clock, Hz. The timer_handler()
+ *                  function should be arranged to be called for SysTick
+ *                  exceptions.
+ */
+extern void timer_init(uint32_t core_hz);
+
+/**
+ * SysTick exception handler. Advances the ticks and calls the functions
+ * of the expired timers. The SysTick exception must have the
+ * IRQ_PRIO_HOUSEKEEPING priority.
+ */
+extern void timer_handler(void);
+
+/**
+ * Set up a timer, not pending.
+ *
+ * @param timer The timer to set up.
+ * @param fn    The function to call on expiration. Called from the
+ *              timer_handler(), so should be short.
+ * @param data  The data to pass to the function.
+ */
+extern void timer_setup(struct timer *timer,
+                        void (*fn)(void *data), void *data);
+
+/**
+ * (Re)start a timer, replacing its previous expiration, if pending.
+ * Can be called from any context at or below the IRQ_PRIO_HOUSEKEEPING
+ * priority, including the timer's function.
+ *
+ * @param timer     The timer to start.
+ * @param delay     Number of ticks to expire after, more than delay and
+ *                  not more than delay + 1 full tick periods from now,
+ *                  or exactly delay + 1 if called from a timer's
+ *                  function. Zero expires on the next tick.
+ * @param period    Number of ticks between subsequent expirations, or
+ *                  zero for a one-shot timer.
+ */
+extern RAMFUNC void timer_start(struct timer *timer,
+                                uint32_t delay, uint32_t period);
+
+/**
+ * Stop a timer, if pending. Can be called from any context at or below
+ * the IRQ_PRIO_HOUSEKEEPING priority.
+ *
+ * @param timer The timer to stop.
+ */
+extern RAMFUNC void timer_stop(struct timer *timer);
+
+/**
+ * Check if a timer is pending, i.e. started and not expired yet, or
+ * periodic.
+ *
+ * @param timer The timer to check.
+ *
+ * @return True if the timer is pending.
+ */
+static inline bool
+timer_is_pending(const struct timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+#endif /* _TIMER_H */
@@ -3,6 +3,18 @@
  */
 #include "printer.h"
 #include "zxprinter.h"
+#include "centronics.h"
+#include "load.h"
+#include "lines.h"
+#include "usbcdc.h"
+#include "output.h"
+#include "history.h"
+#include "dwt.h"
+#include "timer.h"
+#include "irq.h"
+#include "latency.h"
+#include "tune.h"
+#include "console.h"
 #include <init.h>
 #include <usart.h>
 #include <gpio.h>
@@ -15,37 +27,58 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void tim2_irq_handler(void) __attribute__ ((isr));
+void systick_handler(void) __attribute__ ((isr));
 void
-tim2_irq_handler(void)
+systick_handler(void)
 {
-    printer_tim_handler();
+    timer_handler();
 }
 
 void adc1_2_irq_handler(void) __attribute__ ((isr));
-void
+RAMFUNC void
 adc1_2_irq_handler(void)
 {
     printer_adc_handler();
 }
 
-void tim3_irq_handler(void) __attribute__ ((isr));
+void usart1_irq_handler(void) __attribute__ ((isr));
+void
+usart1_irq_handler(void)
+{
+    console_usart_handler();
+}
+
+void usart2_irq_handler(void) __attribute__ ((isr));
+void
+usart2_irq_handler(void)
+{
+    printer_usart_handler();
+}
+
+void usb_lp_can_rx0_irq_handler(void) __attribute__ ((isr));
 void
+usb_lp_can_rx0_irq_handler(void)
+{
+    usbcdc_handler();
+}
+
+void tim3_irq_handler(void) __attribute__ ((isr));
+RAMFUNC void
 tim3_irq_handler(void)
 {
     zxprinter_tim_handler();
 }
 
-void
+RAMFUNC void
 exti_handler(void)
 {
     zxprinter_write_handler();
     /* Clear the interrupt */
-    EXTI->pr |= (1 << ZXPRINTER_PIN_WRITE);
+    EXTI->pr = (1 << ZXPRINTER_PIN_WRITE);
 }
 
 #define EXTI_IRQ_HANDLER(_name) \
-    void                                    \
+    RAMFUNC void                            \
     _name(void)                             \
     {                                       \
         exti_handler();                     \
@@ -60,13 +93,109 @@ EXTI_IRQ_HANDLER(exti4_irq_handler);
 EXTI_IRQ_HANDLER(exti9_5_irq_handler);
 EXTI_IRQ_HANDLER(exti15_10_irq_handler);
 
+/** The timer connecting the USB device after D+ was held low */
+static struct timer usb_connect_timer;
+
+/**
+ * Release the USB D+ line and start the USB CDC device.
+ *
+ * @param data  Not used.
+ */
+static void
+usb_connect(void *data)
+{
+    (void)data;
+    /* Release D+ to the board's pull-up */
+    gpio_pin_conf(GPIO_A, 12,
+                  GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOATING);
+    /* Enable clock to USB, fed by the 72MHz PLL output divided by 1.5 */
+    RCC->cfgr &= ~RCC_CFGR_USBPRE_MASK;
+    RCC->apb1enr |= RCC_APB1ENR_USBEN_MASK;
+    usbcdc_init();
+    irq_set_prio(NVIC_INT_USB_LP_CAN_RX0, IRQ_PRIO_HOUSEKEEPING);
+    nvic_int_set_enable(NVIC_INT_USB_LP_CAN_RX0);
+}
+
+/** Number of consecutive button samples to take a press/release by */
+#define BUTTON_DEBOUNCE_SAMPLES 3
+
+/** The timer sampling the reprint button */
+static struct timer button_timer;
+
+/** Number of consecutive samples the button state differed for */
+static unsigned int button_samples;
+
+/** True if the button is considered pressed */
+static bool button_pressed;
+
+/**
+ * Age of the job to reprint (zero for the most recent), requested by the
+ * button timer or over USB, and held until the reprint can start, or
+ * negative if none
+ */
+static volatile int reprint_age = -1;
+
+/**
+ * Sample the reprint button (PA1, shorted to ground when pressed),
+ * and request a reprint of the most recent job when it's pressed.
+ *
+ * @param data  Not used.
+ */
+static void
+button_sample(void *data)
+{
+    bool pressed = !((GPIO_A->idr >> 1) & 1);
+    (void)data;
+    if (pressed == button_pressed) {
+        button_samples = 0;
+    } else if (++button_samples >= BUTTON_DEBOUNCE_SAMPLES) {
+        button_samples = 0;
+        button_pressed = pressed;
+        if (pressed) {
+            reprint_age = 0;
+        }
+    }
+}
+
+/**
+ * Handle the commands received over USB: a digit from 1 to
+ * HISTORY_JOB_NUM reprints the job that many jobs back, 1 being the most
+ * recent one.
+ */
+static void
+usb_command_poll(void)
+{
+    char c;
+    while (usbcdc_read(&c, 1) == 1) {
+        if (c >= '1' && c < '1' + HISTORY_JOB_NUM) {
+            reprint_age = c - '1';
+        }
+    }
+}
+
+/** Number of lines in the input line ring buffer, a power of two */
+#define LINE_NUM    32
+
+/** Input line ring buffer */
+static volatile uint8_t line_buf[LINE_NUM][LINES_LINE_SIZE];
+
+/** Input line metadata ring buffer */
+static volatile struct linemeta line_meta[LINE_NUM];
+
 int
 main(void)
 {
-    /* Output line buffer */
-    volatile uint8_t line_buf[48] = {0,};
+    enum conv_mode mode;
+    bool smooth;
+    unsigned int i;
+
     /* Basic init */
     init();
+    /* Start the cycle counter, for measurements and short delays */
+    dwt_init(72000000);
+    /* Start the software timer timebase */
+    irq_set_prio_systick(IRQ_PRIO_HOUSEKEEPING);
+    timer_init(72000000);
 
     /*
      * Enable clocks
@@ -79,7 +208,6 @@ main(void)
      * Setup printer with the following.
      * - USART2 at 9600 baud rate, for talking to the printer.
      * - ADC1 channel 0, for monitoring printer status via its power line.
-     * - TIM2 timer fed by doubled 36MHz APB1 clock, for ADC timing.
      * - PC13 GPIO pin for status LED.
      */
 
@@ -98,6 +226,9 @@ main(void)
     RCC->apb1enr |= RCC_APB1ENR_USART2EN_MASK;
     /* Initialize the USART with 9600 baud rate, based on 36MHz PCLK1 */
     usart_init(USART2, 36 * 1000 * 1000, 9600);
+    /* Enable USART interrupt */
+    irq_set_prio(NVIC_INT_USART2, IRQ_PRIO_HOUSEKEEPING);
+    nvic_int_set_enable(NVIC_INT_USART2);
 
     /*
      * Setup ADC
@@ -115,12 +246,8 @@ main(void)
     /*
      * Wait for at least 1us for ADC to stabilize, and for two ADC cycles
      * before starting calibration.
-     * TODO Calibrate the delay loop.
      */
-    {
-        volatile unsigned int i;
-        for (i = 0; i < 360; i++);
-    }
+    dwt_delay_us(1);
     /* Calibrate the ADC */
     ADC1->cr2 |= ADC_CR2_CAL_MASK;
     while (ADC1->cr2 & ADC_CR2_CAL_MASK);
@@ -128,16 +255,9 @@ main(void)
     ADC1->cr2 &= ~ADC_CR2_ADON_MASK;
 
     /* Enable ADC interrupt */
+    irq_set_prio(NVIC_INT_ADC1_2, IRQ_PRIO_HOUSEKEEPING);
     nvic_int_set_enable(NVIC_INT_ADC1_2);
 
-    /*
-     * Setup timer
-     */
-    /* Enable clock to the timer */
-    RCC->apb1enr |= RCC_APB1ENR_TIM2EN_MASK;
-    /* Enable timer interrupt */
-    nvic_int_set_enable(NVIC_INT_TIM2);
-
     /*
      * Setup status LED
      */
@@ -147,14 +267,72 @@ main(void)
                   GPIO_MODE_OUTPUT_2MHZ, GPIO_CNF_OUTPUT_GP_OPEN_DRAIN);
 
     /* Initialize printer module */
-    printer_init(USART2,
+    printer_init(USART2, 36 * 1000 * 1000,
                  /* ADC channel */
                  ADC1, 0,
-                 /* Timer */
-                 TIM2, 72000000,
                  /* Status LED GPIO pin */
                  GPIO_C, 13);
 
+    /*
+     * Setup USB CDC device for streaming captured lines to a host
+     */
+    /* Pull D+ (PA12) low to make the host notice a reconnect */
+    gpio_pin_set(GPIO_A, 12, 0);
+    gpio_pin_conf(GPIO_A, 12,
+                  GPIO_MODE_OUTPUT_2MHZ, GPIO_CNF_OUTPUT_GP_PUSH_PULL);
+    /* Connect in a few milliseconds, without waiting */
+    timer_setup(&usb_connect_timer, usb_connect, NULL);
+    timer_start(&usb_connect_timer, TIMER_MS(10), 0);
+
+    /*
+     * Setup output backends, reading the input line buffer
+     */
+    /*
+     * Configure the mode jumper pins (PA4-PA6) as pulled-up inputs.
+     * Shorting PA4 to ground selects printing whole frames (screen COPY)
+     * rotated to landscape, instead of printing lines as they come.
+     * Shorting PA5 scales lines to the full head width. Shorting PA6
+     * smooths the edges when scaling.
+     */
+    for (i = 4; i <= 6; i++) {
+        gpio_pin_set(GPIO_A, i, 1);
+        gpio_pin_conf(GPIO_A, i, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    }
+    smooth = !((GPIO_A->idr >> 6) & 1);
+    if (!((GPIO_A->idr >> 4) & 1)) {
+        mode = smooth ? CONV_MODE_FRAME_SMOOTH : CONV_MODE_FRAME;
+    } else if (!((GPIO_A->idr >> 5) & 1)) {
+        mode = smooth ? CONV_MODE_LINE_SMOOTH : CONV_MODE_LINE_WIDE;
+    } else {
+        mode = CONV_MODE_LINE;
+    }
+    output_printer_set_mode(mode);
+    lines_init((volatile uint8_t *)line_buf, line_meta, LINE_NUM);
+    history_init();
+    output_add(&output_printer);
+    output_add(&output_history);
+    output_add(&output_usbcdc);
+    /*
+     * Configure the no-printer jumper pin (PC14) as pulled-up input.
+     * Shorting it to ground leaves the printer backend disabled, so lines
+     * are only kept and streamed over USB, at the host's pace, without a
+     * printer attached.
+     */
+    gpio_pin_set(GPIO_C, 14, 1);
+    gpio_pin_conf(GPIO_C, 14, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    output_set_enabled(&output_printer, (GPIO_C->idr >> 14) & 1);
+    output_set_enabled(&output_history, true);
+    output_set_enabled(&output_usbcdc, true);
+
+    /*
+     * Configure the reprint button pin (PA1) as pulled-up input, and
+     * sample it every 10ms
+     */
+    gpio_pin_set(GPIO_A, 1, 1);
+    gpio_pin_conf(GPIO_A, 1, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    timer_setup(&button_timer, button_sample, NULL);
+    timer_start(&button_timer, TIMER_MS(10), TIMER_MS(10));
+
     /*
      * Setup ZX Printer interface with GPIO_B for I/O and
      * the motor-timing TIM3 fed by doubled 36MHz APB1 clock
@@ -162,21 +340,85 @@ main(void)
     /* Enable clock to the timer */
     RCC->apb1enr |= RCC_APB1ENR_TIM3EN_MASK;
     /* Initialize ZX Printer interface module */
-    zxprinter_init(GPIO_B, TIM3, 72000000, line_buf);
+    zxprinter_init(GPIO_B, TIM3, 72000000);
     /* Enable timer interrupt */
+    irq_set_prio(NVIC_INT_TIM3, IRQ_PRIO_ZX_ENCODER);
     nvic_int_set_enable(NVIC_INT_TIM3);
     /* Enable interrupt on the rising edge of the WRITE pin */
     afio_exti_set_port(ZXPRINTER_PIN_WRITE, AFIO_EXTI_PORT_B);
     EXTI->imr |= 1 << ZXPRINTER_PIN_WRITE;
     EXTI->rtsr |= 1 << ZXPRINTER_PIN_WRITE;
+    irq_set_prio_ext(ZXPRINTER_PIN_WRITE, IRQ_PRIO_ZX_BUS);
     nvic_int_set_enable_ext(ZXPRINTER_PIN_WRITE);
 
+    /*
+     * Setup the latency probe, capturing WRITE edges on PB8 with TIM4
+     * channel 3, counting at the doubled 36MHz APB1 clock
+     */
+    RCC->apb1enr |= RCC_APB1ENR_TIM4EN_MASK;
+    latency_init(TIM4);
+
+    /*
+     * Setup the Centronics interface, capturing data bytes from GPIO_B
+     * on STROBE edges with TIM1 and DMA1
+     */
+    RCC->apb2enr |= RCC_APB2ENR_TIM1EN_MASK;
+    RCC->ahbenr |= RCC_AHBENR_DMA1EN_MASK;
+    centronics_init();
+
+    /* Apply the tunable parameters saved to flash, if any */
+    tune_init();
+
+    /*
+     * Setup the tuning console on USART1 at 115200 baud
+     */
+    /* Configure console TX pin (PA9) */
+    gpio_pin_conf(GPIO_A, 9,
+                  GPIO_MODE_OUTPUT_2MHZ,
+                  GPIO_CNF_OUTPUT_AF_PUSH_PULL);
+    /* Configure console RX pin (PA10) as pulled-up input */
+    gpio_pin_set(GPIO_A, 10, 1);
+    gpio_pin_conf(GPIO_A, 10, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    /* Enable clock to USART1 */
+    RCC->apb2enr |= RCC_APB2ENR_USART1EN_MASK;
+    /* Initialize the USART, based on 72MHz PCLK2 */
+    usart_init(USART1, 72 * 1000 * 1000, 115200);
+    console_init(USART1);
+    irq_set_prio(NVIC_INT_USART1, IRQ_PRIO_HOUSEKEEPING);
+    nvic_int_set_enable(NVIC_INT_USART1);
+
+    /*
+     * Configure the load jumper pin (PA7) as pulled-up input. Shorting it
+     * to ground runs the default synthetic load once the printer is up,
+     * reporting the results on the console.
+     */
+    gpio_pin_set(GPIO_A, 7, 1);
+    gpio_pin_conf(GPIO_A, 7, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL);
+    if (!((GPIO_A->idr >> 7) & 1) && output_printer.enabled) {
+        load_start(LOAD_PATTERN_TEXT, 0, LOAD_LINES_DEFAULT);
+    }
+
     /* Transmit */
     do {
         asm ("wfi");
-        if (zxprinter_line_count_in > zxprinter_line_count_out) {
-            printer_print_line((const uint8_t *)line_buf);
-            zxprinter_line_count_out++;
+        usb_command_poll();
+        console_poll();
+        centronics_poll();
+        load_poll();
+        /*
+         * Reprint, if requested, once not printing a job, dropping the
+         * requests for jobs not in the history
+         */
+        if (reprint_age >= 0) {
+            int age = reprint_age;
+            if ((unsigned int)age >= history_job_num() ||
+                output_printer_reprint(age)) {
+                /* Unless requested again meanwhile */
+                __atomic_compare_exchange_n(&reprint_age, &age, -1, false,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED);
+            }
         }
+        while (output_poll());
     } while (1);
 }
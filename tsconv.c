@@ -0,0 +1,783 @@
+/*
+ * Thermal Spectrum batch converter - converts ZX Printer bitmap dumps into
+ * thermal printer byte streams on a host, with the firmware's conversion
+ */
+
+#include "conv.h"
+#include "escpos.h"
+#include "linemeta.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+/** Serial port baud rate, the printer's default */
+#define TSCONV_BAUD         9600
+/** Time to transmit a byte over the serial port, 8N1, us */
+#define TSCONV_BYTE_US      (10 * 1000000 / TSCONV_BAUD)
+/** Time to feed the paper by a dot line, us, at a common 50mm/s */
+#define TSCONV_FEED_US      2500
+/** Dot lines advanced by a text line at the default line spacing */
+#define TSCONV_TEXT_LINES   32
+
+/** A mark in a page's byte stream, where an operation ends */
+struct mark {
+    /* Offset of the end of the operation's bytes */
+    size_t end;
+    /* Time the printer takes to print the operation, us */
+    uint32_t us;
+};
+
+/** A page: an input file, converted to a printer byte stream */
+struct page {
+    /* Path to the input file */
+    const char *path;
+    /* Printer byte stream buffer */
+    uint8_t *buf;
+    /* Length of the byte stream */
+    size_t len;
+    /* Size of the buffer */
+    size_t size;
+    /* Operation end marks, for pacing the output */
+    struct mark *marks;
+    /* Number of marks */
+    size_t mark_num;
+    /* Size of the mark buffer, marks */
+    size_t mark_size;
+    /* Number of input lines */
+    size_t line_num;
+    /* Glyph cache statistics */
+    struct conv_glyph_stats glyph_stats;
+    /* True if the conversion is finished */
+    bool done;
+    /* True if the conversion failed */
+    bool failed;
+};
+
+/*
+ * Written on init, read by workers.
+ */
+/** Conversion mode */
+static enum conv_mode tsconv_mode = CONV_MODE_LINE;
+/** True if recurring glyphs are printed as user-defined characters */
+static bool tsconv_glyphs;
+/** True if the output is paced to the estimated printing time */
+static bool tsconv_pace;
+/** The pages to convert */
+static struct page *tsconv_pages;
+/** Number of pages to convert */
+static size_t tsconv_page_num;
+/** Maximum number of pages converted ahead of the written ones */
+static size_t tsconv_window;
+
+/*
+ * Protected by the mutex.
+ */
+/** Mutex protecting the batch state */
+static pthread_mutex_t tsconv_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Condition signaled when a page is converted or written */
+static pthread_cond_t tsconv_cond = PTHREAD_COND_INITIALIZER;
+/** Index of the next page to convert */
+static size_t tsconv_page_next;
+/** Number of pages written */
+static size_t tsconv_page_written;
+
+/**
+ * Append data to a page's byte stream.
+ *
+ * @param page  The page to append to.
+ * @param ptr   The data to append.
+ * @param len   Length of the data, bytes.
+ */
+static void
+tsconv_page_append(struct page *page, const void *ptr, size_t len)
+{
+    if (page->len + len > page->size) {
+        size_t size = page->size ? page->size * 2 : 4096;
+        while (page->len + len > size) {
+            size *= 2;
+        }
+        page->buf = realloc(page->buf, size);
+        if (page->buf == NULL) {
+            perror("realloc");
+            abort();
+        }
+        page->size = size;
+    }
+    memcpy(page->buf + page->len, ptr, len);
+    page->len += len;
+}
+
+/**
+ * Mark the end of an operation in a page's byte stream, for pacing.
+ *
+ * @param page  The page to mark.
+ * @param us    Time the printer takes to print the operation, us.
+ */
+static void
+tsconv_page_mark(struct page *page, uint32_t us)
+{
+    if (page->mark_num == page->mark_size) {
+        page->mark_size = page->mark_size ? page->mark_size * 2 : 256;
+        page->marks = realloc(page->marks,
+                              page->mark_size * sizeof(*page->marks));
+        if (page->marks == NULL) {
+            perror("realloc");
+            abort();
+        }
+    }
+    page->marks[page->mark_num].end = page->len;
+    page->marks[page->mark_num].us = us;
+    page->mark_num++;
+}
+
+/**
+ * Estimate the time the printer takes to print dot lines, with the
+ * default heating settings the device configures: heating the black dots
+ * of each line in groups, then feeding the paper.
+ *
+ * @param lines Number of dot lines.
+ * @param black Number of black dots in each line, at most.
+ *
+ * @return The estimated time, us.
+ */
+static uint32_t
+tsconv_print_us(size_t lines, size_t black)
+{
+    size_t group = (ESCPOS_HEAT_DOTS_DEFAULT + 1) * 8;
+    size_t heats = (black + group - 1) / group;
+
+    return lines * (TSCONV_FEED_US +
+                    heats * (ESCPOS_HEAT_TIME_DEFAULT +
+                             ESCPOS_HEAT_INTERVAL_DEFAULT) * 10);
+}
+
+/**
+ * Estimate the time the printer takes to print an operation.
+ *
+ * @param op    The operation.
+ *
+ * @return The estimated time, us.
+ */
+static uint32_t
+tsconv_op_us(const struct conv_op *op)
+{
+    size_t black = 0;
+    size_t i;
+
+    if (op->type == CONV_OP_FEED) {
+        return tsconv_print_us(op->len, 0);
+    } else if (op->type == CONV_OP_TEXT) {
+        return tsconv_print_us(TSCONV_TEXT_LINES,
+                               op->len * ESCPOS_GLYPH_WIDTH);
+    } else if (op->type == CONV_OP_GLYPH) {
+        return 0;
+    } else if (op->type == CONV_OP_GLYPH_LINE) {
+        return tsconv_print_us(ESCPOS_GLYPH_HEIGHT,
+                               op->len * ESCPOS_GLYPH_WIDTH);
+    }
+    for (i = 0; i < op->len; i++) {
+        black += __builtin_popcount(op->line[i]);
+    }
+    return tsconv_print_us(1, black);
+}
+
+/**
+ * Encode all the operations waiting in a conversion into a page's byte
+ * stream, as the firmware's printer output would transmit them.
+ *
+ * @param page  The page to append the commands to.
+ * @param conv  The conversion to retrieve the operations from.
+ */
+static void
+tsconv_page_drain(struct page *page, struct conv *conv)
+{
+    uint8_t buf[ESCPOS_LINE_SIZE(CONV_OUT_SIZE)];
+    struct conv_op op;
+
+    _Static_assert(ESCPOS_GLYPH_DEFINE_SIZE <= sizeof(buf) &&
+                   ESCPOS_GLYPH_LINE_SIZE(CONV_IN_SIZE) <= sizeof(buf),
+                   "Glyphs don't fit the command buffer");
+
+    while (conv_get(conv, &op)) {
+        if (op.type == CONV_OP_FEED) {
+            tsconv_page_append(page, buf, escpos_feed(buf, op.len));
+        } else if (op.type == CONV_OP_TEXT) {
+            tsconv_page_append(page, buf, escpos_text(buf, op.line, op.len));
+        } else if (op.type == CONV_OP_GLYPH) {
+            tsconv_page_append(page, buf,
+                               escpos_glyph_define(buf, op.code, op.line));
+        } else if (op.type == CONV_OP_GLYPH_LINE) {
+            tsconv_page_append(page, buf,
+                               escpos_glyph_line(buf, op.line, op.len));
+        } else {
+            tsconv_page_append(page, buf, escpos_line(buf, op.line, op.len));
+        }
+        if (tsconv_pace) {
+            tsconv_page_mark(page, tsconv_op_us(&op));
+        }
+    }
+}
+
+/**
+ * Skip whitespace and comments in a PBM header.
+ *
+ * @param ptr   Pointer to the current position.
+ * @param end   Pointer to the end of the data.
+ *
+ * @return Pointer to the next non-whitespace, non-comment character, or
+ *         end.
+ */
+static const uint8_t *
+tsconv_pbm_skip(const uint8_t *ptr, const uint8_t *end)
+{
+    while (ptr < end) {
+        if (*ptr == '#') {
+            while (ptr < end && *ptr != '\n') {
+                ptr++;
+            }
+        } else if (*ptr == ' ' || *ptr == '\t' ||
+                   *ptr == '\r' || *ptr == '\n') {
+            ptr++;
+        } else {
+            break;
+        }
+    }
+    return ptr;
+}
+
+/**
+ * Parse a decimal number in a PBM header.
+ *
+ * @param pptr  Location of the pointer to the current position, updated.
+ * @param end   Pointer to the end of the data.
+ * @param pnum  Location for the parsed number.
+ *
+ * @return True if the number was parsed, false otherwise.
+ */
+static bool
+tsconv_pbm_num(const uint8_t **pptr, const uint8_t *end, size_t *pnum)
+{
+    const uint8_t *ptr = tsconv_pbm_skip(*pptr, end);
+    size_t num = 0;
+
+    if (ptr >= end || *ptr < '0' || *ptr > '9') {
+        return false;
+    }
+    while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+        num = num * 10 + (*ptr++ - '0');
+    }
+    *pptr = ptr;
+    *pnum = num;
+    return true;
+}
+
+/**
+ * Convert a page: every raw PBM image in the input file, stacked, as a
+ * single job.
+ *
+ * @param page  The page to convert.
+ * @param conv  The conversion state to use.
+ *
+ * @return True if the page was converted, false if it failed.
+ */
+static bool
+tsconv_page_convert(struct page *page, struct conv *conv)
+{
+    int fd;
+    struct stat st;
+    const uint8_t *map = NULL;
+    const uint8_t *ptr;
+    const uint8_t *end;
+    size_t width;
+    size_t height;
+    struct linemeta meta;
+    bool ok = false;
+
+    fd = open(page->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", page->path, strerror(errno));
+        goto cleanup;
+    }
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "%s: %s\n", page->path, strerror(errno));
+            map = NULL;
+            goto cleanup;
+        }
+        madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    conv_init(conv, tsconv_mode);
+    conv_set_glyphs(conv, tsconv_glyphs);
+    ptr = map;
+    end = map + st.st_size;
+    while ((ptr = tsconv_pbm_skip(ptr, end)) < end) {
+        /* Parse the image header */
+        if (end - ptr < 2 || ptr[0] != 'P' || ptr[1] != '4') {
+            fprintf(stderr, "%s: not a raw PBM image\n", page->path);
+            goto cleanup;
+        }
+        ptr += 2;
+        if (!tsconv_pbm_num(&ptr, end, &width) ||
+            !tsconv_pbm_num(&ptr, end, &height) ||
+            ptr >= end) {
+            fprintf(stderr, "%s: invalid PBM header\n", page->path);
+            goto cleanup;
+        }
+        /* Skip the single whitespace character before the raster */
+        ptr++;
+        if (width != CONV_IN_LEN) {
+            fprintf(stderr, "%s: image is %zu dots wide, expecting %u\n",
+                    page->path, width, CONV_IN_LEN);
+            goto cleanup;
+        }
+        if ((size_t)(end - ptr) / CONV_IN_SIZE < height) {
+            fprintf(stderr, "%s: truncated PBM raster\n", page->path);
+            goto cleanup;
+        }
+
+        /* Feed the lines to the conversion, like the output dispatcher */
+        for (; height > 0; height--, ptr += CONV_IN_SIZE) {
+            linemeta_compute(&meta, ptr, CONV_IN_SIZE);
+            while (!conv_is_ready(conv)) {
+                tsconv_page_drain(page, conv);
+            }
+            conv_put(conv, ptr, &meta);
+            tsconv_page_drain(page, conv);
+            page->line_num++;
+        }
+    }
+
+    /* End the job */
+    while (!conv_is_ready(conv)) {
+        tsconv_page_drain(page, conv);
+    }
+    conv_end(conv);
+    tsconv_page_drain(page, conv);
+    page->glyph_stats = conv->glyph_stats;
+    ok = true;
+
+cleanup:
+    if (map != NULL) {
+        munmap((void *)map, st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ok;
+}
+
+/**
+ * Conversion worker thread: convert pages until none are left, staying
+ * within the window of pages ahead of the written ones.
+ *
+ * @param arg   Not used.
+ *
+ * @return NULL.
+ */
+static void *
+tsconv_worker(void *arg)
+{
+    struct conv *conv;
+    size_t index;
+    bool ok;
+
+    (void)arg;
+
+    /* The conversion state holds a frame, keep it off the stack */
+    conv = malloc(sizeof(*conv));
+    if (conv == NULL) {
+        perror("malloc");
+        abort();
+    }
+
+    pthread_mutex_lock(&tsconv_mutex);
+    while (true) {
+        while (tsconv_page_next < tsconv_page_num &&
+               tsconv_page_next - tsconv_page_written >= tsconv_window) {
+            pthread_cond_wait(&tsconv_cond, &tsconv_mutex);
+        }
+        if (tsconv_page_next >= tsconv_page_num) {
+            break;
+        }
+        index = tsconv_page_next++;
+        pthread_mutex_unlock(&tsconv_mutex);
+
+        ok = tsconv_page_convert(&tsconv_pages[index], conv);
+
+        pthread_mutex_lock(&tsconv_mutex);
+        tsconv_pages[index].failed = !ok;
+        tsconv_pages[index].done = true;
+        pthread_cond_broadcast(&tsconv_cond);
+    }
+    pthread_mutex_unlock(&tsconv_mutex);
+
+    free(conv);
+    return NULL;
+}
+
+/**
+ * Write data to a file descriptor completely.
+ *
+ * @param fd    The file descriptor to write to.
+ * @param ptr   The data to write.
+ * @param len   Length of the data, bytes.
+ *
+ * @return True if written, false on error, with errno set.
+ */
+static bool
+tsconv_write(int fd, const uint8_t *ptr, size_t len)
+{
+    ssize_t rc;
+
+    while (len > 0) {
+        rc = write(fd, ptr, len);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+/**
+ * Get the current monotonic time.
+ *
+ * @return The time, us.
+ */
+static uint64_t
+tsconv_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Write a page to a serial port, an operation at a time, without
+ * overrunning the printer: each operation is sent to finish arriving as
+ * the printer is estimated to finish printing the previous ones.
+ *
+ * @param fd    The serial port file descriptor.
+ * @param page  The page to write, with the operation end marks.
+ * @param pdue  Location of the time the printer finishes printing
+ *              everything written, us, updated.
+ *
+ * @return True if written, false on error, with errno set.
+ */
+static bool
+tsconv_write_paced(int fd, const struct page *page, uint64_t *pdue)
+{
+    size_t start = 0;
+    uint64_t now;
+    uint64_t tx;
+    struct timespec ts;
+    size_t i;
+
+    for (i = 0; i < page->mark_num; i++) {
+        const struct mark *mark = &page->marks[i];
+        size_t len = mark->end - start;
+
+        tx = (uint64_t)len * TSCONV_BYTE_US;
+        if (*pdue > tsconv_now_us() + tx) {
+            ts.tv_sec = (*pdue - tx) / 1000000;
+            ts.tv_nsec = (*pdue - tx) % 1000000 * 1000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &ts, NULL) == EINTR);
+        }
+        if (!tsconv_write(fd, page->buf + start, len) || tcdrain(fd) < 0) {
+            return false;
+        }
+        now = tsconv_now_us();
+        if (*pdue < now) {
+            *pdue = now;
+        }
+        *pdue += mark->us;
+        start = mark->end;
+    }
+    return tsconv_write(fd, page->buf + start, page->len - start);
+}
+
+/**
+ * Configure a serial port for sending printer byte streams: raw, 8N1,
+ * at the printer's 9600 baud.
+ *
+ * @param fd    The serial port file descriptor.
+ *
+ * @return True if configured, false on error, with errno set.
+ */
+static bool
+tsconv_serial_setup(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) < 0) {
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cflag |= CS8 | CLOCAL;
+    _Static_assert(TSCONV_BAUD == 9600, "Serial speed mismatch");
+    cfsetispeed(&tio, B9600);
+    cfsetospeed(&tio, B9600);
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+/**
+ * Output usage information.
+ *
+ * @param stream    The stream to output to.
+ * @param name      The program name.
+ */
+static void
+tsconv_usage(FILE *stream, const char *name)
+{
+    fprintf(stream,
+            "Usage: %s [OPTION]... PBM...\n"
+            "Convert ZX Printer bitmap dumps (raw PBM images 256 dots wide,\n"
+            "one page per file, images in a file stacked) into the byte\n"
+            "stream Thermal Spectrum would send to the thermal printer.\n"
+            "\n"
+            "Options:\n"
+            "  -f       Print frames rotated to landscape (frame mode)\n"
+            "  -w       Scale lines 1.5 times to the full head width\n"
+            "  -s       Smooth the edges when scaling (implies -w without -f)\n"
+            "  -g       Print recurring glyphs as user-defined characters,\n"
+            "           when scaling without smoothing; report the savings\n"
+            "  -i       Prepend the printer power-up command sequence\n"
+            "  -o PATH  Write to PATH instead of standard output; serial\n"
+            "           ports are configured for the printer, and paced\n"
+            "           to its estimated printing speed\n"
+            "  -j NUM   Convert with NUM threads (default: online CPUs)\n"
+            "  -b       Benchmark: convert without writing, report speed\n"
+            "  -h       Output this help and exit\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *output_path = NULL;
+    bool init = false;
+    bool bench = false;
+    bool wide = false;
+    bool smooth = false;
+    long thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads;
+    int fd = STDOUT_FILENO;
+    struct timespec start, stop;
+    double secs;
+    size_t line_num = 0;
+    size_t byte_num = 0;
+    struct conv_glyph_stats glyph_stats = {0};
+    uint64_t due = 0;
+    bool ok;
+    int status = 0;
+    int opt;
+    long i;
+
+    while ((opt = getopt(argc, argv, "fwsgio:j:bh")) != -1) {
+        switch (opt) {
+        case 'f':
+            tsconv_mode = CONV_MODE_FRAME;
+            break;
+        case 'w':
+            wide = true;
+            break;
+        case 's':
+            smooth = true;
+            break;
+        case 'g':
+            tsconv_glyphs = true;
+            break;
+        case 'i':
+            init = true;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'j':
+            thread_num = strtol(optarg, NULL, 10);
+            if (thread_num < 1) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'b':
+            bench = true;
+            break;
+        case 'h':
+            tsconv_usage(stdout, argv[0]);
+            return 0;
+        default:
+            tsconv_usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        tsconv_usage(stderr, argv[0]);
+        return 2;
+    }
+    if (thread_num < 1) {
+        thread_num = 1;
+    }
+    if (tsconv_mode == CONV_MODE_FRAME) {
+        if (smooth) {
+            tsconv_mode = CONV_MODE_FRAME_SMOOTH;
+        }
+    } else if (smooth) {
+        tsconv_mode = CONV_MODE_LINE_SMOOTH;
+    } else if (wide) {
+        tsconv_mode = CONV_MODE_LINE_WIDE;
+    }
+
+    /* Open the output */
+    if (!bench && output_path != NULL) {
+        fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY,
+                  0666);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+            return 1;
+        }
+        if (isatty(fd)) {
+            if (!tsconv_serial_setup(fd)) {
+                fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+                return 1;
+            }
+            tsconv_pace = true;
+        }
+    }
+
+    /* Prepend the commands the device sends after power-up */
+    if (init && !bench) {
+        uint8_t buf[ESCPOS_RESET_SIZE + ESCPOS_CONFIG_SIZE +
+                    ESCPOS_FEED_SIZE];
+        size_t len = escpos_reset(buf);
+        len += escpos_config(buf + len,
+                             ESCPOS_HEAT_DOTS_DEFAULT,
+                             ESCPOS_HEAT_TIME_DEFAULT,
+                             ESCPOS_HEAT_INTERVAL_DEFAULT);
+        len += escpos_feed(buf + len, 3);
+        if (!tsconv_write(fd, buf, len)) {
+            perror("write");
+            return 1;
+        }
+    }
+
+    /* Setup the pages */
+    tsconv_page_num = argc - optind;
+    tsconv_pages = calloc(tsconv_page_num, sizeof(*tsconv_pages));
+    threads = calloc(thread_num, sizeof(*threads));
+    if (tsconv_pages == NULL || threads == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    for (i = 0; i < (long)tsconv_page_num; i++) {
+        tsconv_pages[i].path = argv[optind + i];
+    }
+    tsconv_window = thread_num * 4;
+
+    /* Convert the pages in parallel */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < thread_num; i++) {
+        int rc = pthread_create(&threads[i], NULL, tsconv_worker, NULL);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+            return 1;
+        }
+    }
+
+    /* Write the pages in order, as they're converted */
+    for (i = 0; i < (long)tsconv_page_num; i++) {
+        struct page *page = &tsconv_pages[i];
+
+        pthread_mutex_lock(&tsconv_mutex);
+        while (!page->done) {
+            pthread_cond_wait(&tsconv_cond, &tsconv_mutex);
+        }
+        pthread_mutex_unlock(&tsconv_mutex);
+
+        if (page->failed) {
+            status = 1;
+        } else if (!bench && status == 0) {
+            ok = tsconv_pace ? tsconv_write_paced(fd, page, &due)
+                             : tsconv_write(fd, page->buf, page->len);
+            if (!ok) {
+                fprintf(stderr, "%s: %s\n",
+                        output_path ? output_path : "stdout",
+                        strerror(errno));
+                status = 1;
+            }
+        }
+        line_num += page->line_num;
+        byte_num += page->len;
+        glyph_stats.bands += page->glyph_stats.bands;
+        glyph_stats.raster_bands += page->glyph_stats.raster_bands;
+        glyph_stats.hits += page->glyph_stats.hits;
+        glyph_stats.uploads += page->glyph_stats.uploads;
+        glyph_stats.saved += page->glyph_stats.saved;
+        free(page->buf);
+        page->buf = NULL;
+        free(page->marks);
+        page->marks = NULL;
+
+        pthread_mutex_lock(&tsconv_mutex);
+        tsconv_page_written++;
+        pthread_cond_broadcast(&tsconv_cond);
+        pthread_mutex_unlock(&tsconv_mutex);
+    }
+
+    for (i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (bench) {
+        secs = (stop.tv_sec - start.tv_sec) +
+               (stop.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr,
+                "%zu pages, %zu lines, %zu bytes out, %ld threads, "
+                "%.3f s: %.1f pages/s, %.0f lines/s\n",
+                tsconv_page_num, line_num, byte_num, thread_num,
+                secs, tsconv_page_num / secs, line_num / secs);
+    }
+
+    if (tsconv_glyphs) {
+        fprintf(stderr,
+                "%" PRIu32 " glyph bands, %" PRIu32 " raster bands, "
+                "%" PRIu32 " hits, %" PRIu32 " uploads (%.1f%% hit rate), "
+                "%" PRIu32 " bytes saved\n",
+                glyph_stats.bands, glyph_stats.raster_bands,
+                glyph_stats.hits, glyph_stats.uploads,
+                glyph_stats.hits == 0 ? 0.0 :
+                    glyph_stats.hits * 100.0 /
+                    (glyph_stats.hits + glyph_stats.uploads),
+                glyph_stats.saved);
+    }
+
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    free(threads);
+    free(tsconv_pages);
+    return status;
+}
@@ -0,0 +1,230 @@
+/*
+ * Host line streamer: feeds ZX Printer bitmap dumps through the firmware's
+ * line ring buffer and output dispatcher into the file backend, producing
+ * the line stream the device sends over USB
+ */
+
+#include "output.h"
+#include "lines.h"
+#include "linemeta.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of lines in the line ring buffer, as on the device */
+#define TSSTREAM_LINE_NUM   32
+
+/** Line ring buffer */
+static volatile uint8_t tsstream_line_buf[TSSTREAM_LINE_NUM][LINES_LINE_SIZE];
+
+/** Line metadata ring buffer */
+static volatile struct linemeta tsstream_line_meta[TSSTREAM_LINE_NUM];
+
+/** The file descriptor the lines are written to */
+static int tsstream_fd = STDOUT_FILENO;
+
+/**
+ * Dispatch the input lines and job ends until the file backend has taken
+ * them all, waiting for the file to accept more when needed.
+ */
+static void
+tsstream_drain(void)
+{
+    struct pollfd pfd = {.fd = tsstream_fd, .events = POLLOUT};
+
+    while (output_file.count != lines_count_in ||
+           output_file.job != lines_job_count) {
+        if (!output_poll()) {
+            poll(&pfd, 1, -1);
+        }
+    }
+}
+
+/**
+ * Read a decimal number from a PBM header, skipping whitespace and
+ * comments before it.
+ *
+ * @param file  The file to read from.
+ * @param pnum  Location for the number.
+ *
+ * @return True if the number was read, false otherwise.
+ */
+static bool
+tsstream_pbm_num(FILE *file, size_t *pnum)
+{
+    int c;
+    size_t num = 0;
+
+    while ((c = getc(file)) == '#' || c == ' ' || c == '\t' ||
+           c == '\r' || c == '\n') {
+        if (c == '#') {
+            while ((c = getc(file)) != EOF && c != '\n');
+        }
+    }
+    if (c < '0' || c > '9') {
+        return false;
+    }
+    for (; c >= '0' && c <= '9'; c = getc(file)) {
+        num = num * 10 + (c - '0');
+    }
+    /* Leave the single whitespace character after the number consumed */
+    *pnum = num;
+    return true;
+}
+
+/**
+ * Stream a page: every raw PBM image in the input file, stacked, as a
+ * single job.
+ *
+ * @param path  Path to the input file.
+ *
+ * @return True if the page was streamed, false if it failed.
+ */
+static bool
+tsstream_page(const char *path)
+{
+    uint8_t line[LINES_LINE_SIZE];
+    struct linemeta meta;
+    volatile uint8_t *slot;
+    size_t width, height, i;
+    bool ok = false;
+    FILE *file;
+    int c;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    lines_claim(LINES_OWNER_ZXPRINTER);
+    while ((c = getc(file)) != EOF) {
+        /* Parse the image header */
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        if (c != 'P' || getc(file) != '4' ||
+            !tsstream_pbm_num(file, &width) ||
+            !tsstream_pbm_num(file, &height)) {
+            fprintf(stderr, "%s: not a raw PBM image\n", path);
+            goto cleanup;
+        }
+        if (width != LINES_LINE_LEN) {
+            fprintf(stderr, "%s: image is %zu dots wide, expecting %u\n",
+                    path, width, LINES_LINE_LEN);
+            goto cleanup;
+        }
+        /* Input the lines, like the ZX Printer interface */
+        for (; height > 0; height--) {
+            if (fread(line, sizeof(line), 1, file) != 1) {
+                fprintf(stderr, "%s: truncated PBM raster\n", path);
+                goto cleanup;
+            }
+            linemeta_compute(&meta, line, sizeof(line));
+            tsstream_drain();
+            slot = lines_next();
+            for (i = 0; i < sizeof(line); i++) {
+                slot[i] = line[i];
+            }
+            lines_put(&meta);
+        }
+    }
+    ok = true;
+
+cleanup:
+    /* End the job with the lines input so far */
+    lines_job_end();
+    lines_release();
+    tsstream_drain();
+    fclose(file);
+    return ok;
+}
+
+/**
+ * Output usage information.
+ *
+ * @param stream    The stream to output to.
+ * @param name      The program name.
+ */
+static void
+tsstream_usage(FILE *stream, const char *name)
+{
+    fprintf(stream,
+            "Usage: %s [OPTION]... PBM...\n"
+            "Stream ZX Printer bitmap dumps (raw PBM images 256 dots wide,\n"
+            "one job per file, images in a file stacked) through the\n"
+            "firmware's output dispatcher, as Thermal Spectrum would stream\n"
+            "them over USB.\n"
+            "\n"
+            "Options:\n"
+            "  -r       Write bare line bytes instead of one-line PBM images\n"
+            "  -o PATH  Write to PATH instead of standard output\n"
+            "  -h       Output this help and exit\n",
+            name);
+}
+
+int
+main(int argc, char **argv)
+{
+    enum output_format format = OUTPUT_FORMAT_PBM;
+    const char *output_path = NULL;
+    int status = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ro:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            format = OUTPUT_FORMAT_RAW;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'h':
+            tsstream_usage(stdout, argv[0]);
+            return 0;
+        default:
+            tsstream_usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        tsstream_usage(stderr, argv[0]);
+        return 2;
+    }
+
+    if (output_path != NULL) {
+        tsstream_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (tsstream_fd < 0) {
+            fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    lines_init((volatile uint8_t *)tsstream_line_buf, tsstream_line_meta,
+               TSSTREAM_LINE_NUM);
+    output_file_open(tsstream_fd, format);
+    output_add(&output_file);
+    output_set_enabled(&output_file, true);
+
+    for (; optind < argc; optind++) {
+        if (!tsstream_page(argv[optind])) {
+            status = 1;
+        }
+    }
+
+    if (output_file.dropped != 0) {
+        fprintf(stderr, "%u lines dropped\n", output_file.dropped);
+        status = 1;
+    }
+    if (tsstream_fd != STDOUT_FILENO) {
+        close(tsstream_fd);
+    }
+    return status;
+}
@@ -0,0 +1,218 @@
+/*
+ * Runtime-tunable parameters, with a profile saved to flash
+ */
+
+#include "tune.h"
+#include "flash.h"
+#include "printer.h"
+#include "zxprinter.h"
+#include "output.h"
+#include "timer.h"
+#include "lines.h"
+#include "centronics.h"
+#include <misc.h>
+#include <string.h>
+
+const struct tune_param tune_params[TUNE_NUM] = {
+    [TUNE_ZX_CYCLE_MS] = {
+        "zx_cycle_ms",
+        ZXPRINTER_CYCLE_MS_MIN, ZXPRINTER_CYCLE_MS_MAX, ZXPRINTER_CYCLE_MS
+    },
+    [TUNE_BUSY_TICKS] = {
+        "busy_ticks",
+        1, TIMER_MS(100), PRINTER_BUSY_TICKS_DEFAULT
+    },
+    [TUNE_HEAT_DOTS] = {
+        "heat_dots",
+        0, 0xFF, ESCPOS_HEAT_DOTS_DEFAULT
+    },
+    [TUNE_HEAT_TIME] = {
+        "heat_time",
+        3, 0xFF, ESCPOS_HEAT_TIME_DEFAULT
+    },
+    [TUNE_HEAT_INTERVAL] = {
+        "heat_interval",
+        0, 0xFF, ESCPOS_HEAT_INTERVAL_DEFAULT
+    },
+    [TUNE_PRINTER_BAUD] = {
+        "printer_baud",
+        1200, 115200, 9600
+    },
+    [TUNE_GLYPHS] = {
+        "glyphs",
+        0, 1, 0
+    },
+};
+
+/** A tunable parameter profile, as saved to flash */
+struct tune_profile {
+    /* Profile signature, changing with the parameter set */
+    uint32_t magic;
+    /* Parameter values, indexed by enum tune_id */
+    uint32_t values[TUNE_NUM];
+    /* Inverted sum of the magic and the values */
+    uint32_t check;
+};
+
+/** Profile signature: "TS" and the number of parameters */
+#define TUNE_PROFILE_MAGIC  (0x54530000 | TUNE_NUM)
+
+/** Current parameter values */
+static struct tune_profile tune_profile;
+
+/**
+ * Compute the check value of a profile.
+ *
+ * @param profile   The profile to compute the check value of.
+ *
+ * @return The check value.
+ */
+static uint32_t
+tune_profile_check(const struct tune_profile *profile)
+{
+    uint32_t sum = profile->magic;
+    size_t i;
+    for (i = 0; i < TUNE_NUM; i++) {
+        sum += profile->values[i];
+    }
+    return ~sum;
+}
+
+/**
+ * Check if a profile is valid: signed, intact, and with all values in
+ * range.
+ *
+ * @param profile   The profile to check.
+ *
+ * @return True if the profile is valid.
+ */
+static bool
+tune_profile_is_valid(const struct tune_profile *profile)
+{
+    size_t i;
+    if (profile->magic != TUNE_PROFILE_MAGIC ||
+        profile->check != tune_profile_check(profile)) {
+        return false;
+    }
+    for (i = 0; i < TUNE_NUM; i++) {
+        if (profile->values[i] < tune_params[i].min ||
+            profile->values[i] > tune_params[i].max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Apply the current value of a parameter to the module using it.
+ *
+ * @param id    The parameter identifier.
+ */
+static void
+tune_apply(enum tune_id id)
+{
+    const uint32_t *values = tune_profile.values;
+
+    switch (id) {
+    case TUNE_ZX_CYCLE_MS:
+        zxprinter_set_cycle_ms(values[id]);
+        break;
+    case TUNE_BUSY_TICKS:
+        printer_set_busy_ticks(values[id]);
+        break;
+    case TUNE_HEAT_DOTS:
+    case TUNE_HEAT_TIME:
+    case TUNE_HEAT_INTERVAL:
+        printer_set_heat(values[TUNE_HEAT_DOTS],
+                         values[TUNE_HEAT_TIME],
+                         values[TUNE_HEAT_INTERVAL]);
+        break;
+    case TUNE_PRINTER_BAUD:
+        printer_set_baud(values[id]);
+        break;
+    case TUNE_GLYPHS:
+        output_printer_set_glyphs(values[id] != 0);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+void
+tune_init(void)
+{
+    size_t size;
+    const struct tune_profile *saved = flash_last_page(&size);
+    enum tune_id id;
+
+    assert(sizeof(*saved) <= size);
+
+    if (tune_profile_is_valid(saved)) {
+        tune_profile = *saved;
+        for (id = 0; id < TUNE_NUM; id++) {
+            tune_apply(id);
+        }
+    } else {
+        tune_reset();
+    }
+}
+
+enum tune_id
+tune_find(const char *name)
+{
+    enum tune_id id;
+    for (id = 0; id < TUNE_NUM && strcmp(tune_params[id].name, name) != 0;
+         id++);
+    return id;
+}
+
+uint32_t
+tune_get(enum tune_id id)
+{
+    assert(id < TUNE_NUM);
+    return tune_profile.values[id];
+}
+
+bool
+tune_set(enum tune_id id, uint32_t value)
+{
+    assert(id < TUNE_NUM);
+    if (value < tune_params[id].min || value > tune_params[id].max) {
+        return false;
+    }
+    tune_profile.values[id] = value;
+    tune_apply(id);
+    return true;
+}
+
+void
+tune_reset(void)
+{
+    enum tune_id id;
+    for (id = 0; id < TUNE_NUM; id++) {
+        tune_profile.values[id] = tune_params[id].def;
+        tune_apply(id);
+    }
+}
+
+bool
+tune_save(void)
+{
+    size_t size;
+    const void *page = flash_last_page(&size);
+    bool ok;
+
+    /*
+     * Erasing stalls the input interrupts and the BUSY updates, don't
+     * lose a job's lines, or the bytes the host sends meanwhile
+     */
+    if (lines_owner != LINES_OWNER_NONE || !centronics_hold()) {
+        return false;
+    }
+    tune_profile.magic = TUNE_PROFILE_MAGIC;
+    tune_profile.check = tune_profile_check(&tune_profile);
+    ok = flash_write_page(page, &tune_profile, sizeof(tune_profile));
+    centronics_release();
+    return ok;
+}
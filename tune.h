@@ -0,0 +1,98 @@
+/*
+ * Runtime-tunable parameters, with a profile saved to flash
+ */
+
+#ifndef _TUNE_H
+#define _TUNE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Tunable parameter identifier */
+enum tune_id {
+    /* ZX Printer stylus cycle duration, ms */
+    TUNE_ZX_CYCLE_MS,
+    /* Time to consider the printer busy after its busy current, ticks */
+    TUNE_BUSY_TICKS,
+    /* Printer max heated dots, in units of 8 dots minus one */
+    TUNE_HEAT_DOTS,
+    /* Printer heating time, in 10us units */
+    TUNE_HEAT_TIME,
+    /* Printer heating interval, in 10us units */
+    TUNE_HEAT_INTERVAL,
+    /* Printer USART baud rate */
+    TUNE_PRINTER_BAUD,
+    /* Print recurring glyphs as user-defined characters, 0 or 1 */
+    TUNE_GLYPHS,
+    /* Number of tunable parameters */
+    TUNE_NUM
+};
+
+/** Tunable parameter description */
+struct tune_param {
+    /* Name */
+    const char *name;
+    /* Minimum value */
+    uint32_t min;
+    /* Maximum value */
+    uint32_t max;
+    /* Default value */
+    uint32_t def;
+};
+
+/** Descriptions of the tunable parameters, indexed by enum tune_id */
+extern const struct tune_param tune_params[TUNE_NUM];
+
+/**
+ * Initialize the tunable parameters from the profile saved to flash, or
+ * the defaults, if there is none, and apply them. Requires the printer and
+ * the ZX Printer interface initialized.
+ */
+extern void tune_init(void);
+
+/**
+ * Look up a tunable parameter by name.
+ *
+ * @param name  The name to look up.
+ *
+ * @return The parameter identifier, or TUNE_NUM if not found.
+ */
+extern enum tune_id tune_find(const char *name);
+
+/**
+ * Get the current value of a tunable parameter.
+ *
+ * @param id    The parameter identifier.
+ *
+ * @return The current value.
+ */
+extern uint32_t tune_get(enum tune_id id);
+
+/**
+ * Set and apply a tunable parameter. Each parameter is switched
+ * atomically by the module using it, at the next opportunity.
+ *
+ * @param id    The parameter identifier.
+ * @param value The value to set.
+ *
+ * @return True if the value was set, false if it's out of range.
+ */
+extern bool tune_set(enum tune_id id, uint32_t value);
+
+/**
+ * Set and apply the default values of all tunable parameters.
+ */
+extern void tune_reset(void);
+
+/**
+ * Save the current values of all tunable parameters to flash, to be
+ * applied on the next boot. Stalls the core while erasing and
+ * programming the flash, so refuses while an input owns the line ring, or
+ * the parallel port is receiving, and holds the parallel port host off.
+ *
+ * @return True if saved, false if an input is busy, or failed.
+ */
+extern bool tune_save(void);
+
+#endif /* _TUNE_H */
@@ -0,0 +1,812 @@
+/*
+ * USB CDC ACM device, serial stream
+ */
+
+#include "usbcdc.h"
+#include "irq.h"
+#include <misc.h>
+#include <string.h>
+
+/** USB full-speed device peripheral registers */
+struct usbcdc_regs {
+    /* Endpoint registers */
+    uint32_t epr[8];
+    uint32_t reserved[8];
+    /* Control register */
+    uint32_t cntr;
+    /* Interrupt status register */
+    uint32_t istr;
+    /* Frame number register */
+    uint32_t fnr;
+    /* Device address register */
+    uint32_t daddr;
+    /* Buffer table address register */
+    uint32_t btable;
+};
+
+/** USB peripheral registers */
+#define USBCDC_REGS ((volatile struct usbcdc_regs *)0x40005C00)
+
+/**
+ * USB packet memory area, each 32-bit word holding 16 bits of the
+ * memory in its lower half.
+ */
+#define USBCDC_PMA  ((volatile uint32_t *)0x40006000)
+
+/* Control register bits */
+#define USBCDC_CNTR_FRES        0x0001
+#define USBCDC_CNTR_RESETM      0x0400
+#define USBCDC_CNTR_CTRM        0x8000
+
+/* Interrupt status register bits */
+#define USBCDC_ISTR_EP_ID_MASK  0x000F
+#define USBCDC_ISTR_RESET       0x0400
+#define USBCDC_ISTR_CTR         0x8000
+
+/* Device address register bits */
+#define USBCDC_DADDR_EF         0x0080
+
+/* Endpoint register bits */
+#define USBCDC_EPR_STAT_TX_LSB  4
+#define USBCDC_EPR_STAT_TX_MASK 0x0030
+#define USBCDC_EPR_DTOG_TX      0x0040
+#define USBCDC_EPR_CTR_TX       0x0080
+#define USBCDC_EPR_TYPE_BULK    0x0000
+#define USBCDC_EPR_TYPE_CONTROL 0x0200
+#define USBCDC_EPR_TYPE_INTR    0x0600
+#define USBCDC_EPR_SETUP        0x0800
+#define USBCDC_EPR_STAT_RX_LSB  12
+#define USBCDC_EPR_STAT_RX_MASK 0x3000
+#define USBCDC_EPR_DTOG_RX      0x4000
+#define USBCDC_EPR_CTR_RX       0x8000
+/* Endpoint register bits kept by writing their read value */
+#define USBCDC_EPR_KEEP_MASK    0x070F
+
+/** Endpoint transfer status */
+enum usbcdc_stat {
+    USBCDC_STAT_DISABLED    = 0,
+    USBCDC_STAT_STALL       = 1,
+    USBCDC_STAT_NAK         = 2,
+    USBCDC_STAT_VALID       = 3,
+};
+
+/** Endpoint numbers */
+enum usbcdc_ep {
+    /* Control */
+    USBCDC_EP_CTL       = 0,
+    /* Bulk data IN, to host */
+    USBCDC_EP_DATA_IN   = 1,
+    /* Bulk data OUT, from host */
+    USBCDC_EP_DATA_OUT  = 2,
+    /* Interrupt notification IN, to host */
+    USBCDC_EP_NOTIF     = 3,
+};
+
+/** Maximum packet size of control and bulk data endpoints */
+#define USBCDC_PACKET_SIZE  64
+
+/** Maximum packet size of the notification endpoint */
+#define USBCDC_NOTIF_PACKET_SIZE    8
+
+/*
+ * Packet memory layout: the buffer descriptor table first, then the
+ * endpoint buffers.
+ */
+#define USBCDC_PMA_CTL_RX       0x040
+#define USBCDC_PMA_CTL_TX       0x080
+#define USBCDC_PMA_DATA_IN      0x0C0
+#define USBCDC_PMA_DATA_OUT     0x100
+#define USBCDC_PMA_NOTIF        0x140
+
+/** Reception buffer size descriptor for USBCDC_PACKET_SIZE bytes */
+#define USBCDC_PMA_COUNT_RX_64  0x8400
+
+/* Standard requests */
+#define USBCDC_REQ_GET_STATUS           0x00
+#define USBCDC_REQ_SET_ADDRESS          0x05
+#define USBCDC_REQ_GET_DESCRIPTOR       0x06
+#define USBCDC_REQ_GET_CONFIGURATION    0x08
+#define USBCDC_REQ_SET_CONFIGURATION    0x09
+/* CDC class requests */
+#define USBCDC_REQ_SET_LINE_CODING          0x20
+#define USBCDC_REQ_GET_LINE_CODING          0x21
+#define USBCDC_REQ_SET_CONTROL_LINE_STATE   0x22
+
+/* Descriptor types */
+#define USBCDC_DESC_DEVICE          1
+#define USBCDC_DESC_CONFIGURATION   2
+#define USBCDC_DESC_STRING          3
+
+/** Device descriptor */
+static const uint8_t usbcdc_desc_device[] = {
+    18, USBCDC_DESC_DEVICE,
+    /* USB 2.0 */
+    0x00, 0x02,
+    /* Communications device class */
+    0x02, 0x00, 0x00,
+    USBCDC_PACKET_SIZE,
+    /* pid.codes test VID/PID */
+    0x09, 0x12, 0x01, 0x00,
+    /* Device release 1.00 */
+    0x00, 0x01,
+    /* Manufacturer, product, and no serial number strings */
+    1, 2, 0,
+    /* One configuration */
+    1,
+};
+
+/** Configuration descriptor, with all the subordinate descriptors */
+static const uint8_t usbcdc_desc_configuration[] = {
+    9, USBCDC_DESC_CONFIGURATION,
+    /* Total length */
+    67, 0,
+    /* Two interfaces, configuration one, no string */
+    2, 1, 0,
+    /* Bus-powered, 100mA */
+    0x80, 50,
+
+    /* Communication interface: CDC, abstract control model */
+    9, 4, 0, 0, 1, 0x02, 0x02, 0x00, 0,
+    /* Header functional descriptor, CDC 1.10 */
+    5, 0x24, 0x00, 0x10, 0x01,
+    /* Call management functional descriptor, no call management */
+    5, 0x24, 0x01, 0x00, 1,
+    /* ACM functional descriptor, line coding and state supported */
+    4, 0x24, 0x02, 0x02,
+    /* Union functional descriptor */
+    5, 0x24, 0x06, 0, 1,
+    /* Notification endpoint, interrupt IN */
+    7, 5, 0x80 | USBCDC_EP_NOTIF, 0x03, USBCDC_NOTIF_PACKET_SIZE, 0, 255,
+
+    /* Data interface */
+    9, 4, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    /* Data endpoint, bulk OUT */
+    7, 5, USBCDC_EP_DATA_OUT, 0x02, USBCDC_PACKET_SIZE, 0, 0,
+    /* Data endpoint, bulk IN */
+    7, 5, 0x80 | USBCDC_EP_DATA_IN, 0x02, USBCDC_PACKET_SIZE, 0, 0,
+};
+
+/** String descriptor zero, listing supported languages */
+static const uint8_t usbcdc_desc_string_langs[] = {
+    4, USBCDC_DESC_STRING,
+    /* English (United States) */
+    0x09, 0x04,
+};
+
+/** ASCII strings for string descriptors, starting at index one */
+static const char *const usbcdc_strings[] = {
+    "Thermal Spectrum",
+    "Thermal Spectrum ZX Printer",
+};
+
+/** Current configuration value, zero if not configured */
+static volatile uint8_t usbcdc_configuration;
+
+/** Device address to assign after the status stage, zero if none */
+static uint8_t usbcdc_address;
+
+/** True if DTR is asserted by the host */
+static volatile bool usbcdc_dtr;
+
+/** Line coding, as set by the host. Ignored, but reported back. */
+static uint8_t usbcdc_line_coding[7] = {
+    /* 9600 baud */
+    0x80, 0x25, 0x00, 0x00,
+    /* One stop bit, no parity, eight data bits */
+    0, 0, 8
+};
+
+/** True if the line coding is expected in the next control OUT packet */
+static bool usbcdc_line_coding_pending;
+
+/** Buffer for composing control transfer replies */
+static uint8_t usbcdc_ctl_buf[USBCDC_PACKET_SIZE];
+
+/** Next control IN data to transmit */
+static const uint8_t *usbcdc_ctl_ptr;
+
+/** Length of the control IN data left to transmit, bytes */
+static size_t usbcdc_ctl_len;
+
+/** True if the control IN data has to be terminated by an empty packet */
+static bool usbcdc_ctl_zlp;
+
+/** Size of the transmit ring buffer, a power of two */
+#define USBCDC_TX_BUF_SIZE  1024
+
+/** Transmit ring buffer */
+static uint8_t usbcdc_tx_buf[USBCDC_TX_BUF_SIZE];
+
+/** Number of bytes written to the transmit buffer, updated by writer */
+static volatile uint32_t usbcdc_tx_head;
+
+/** Number of bytes sent from the transmit buffer, updated by handler */
+static volatile uint32_t usbcdc_tx_tail;
+
+/** True if a data IN packet is waiting to be sent to the host */
+static volatile bool usbcdc_tx_busy;
+
+/** Size of the receive ring buffer, a power of two, at least a packet */
+#define USBCDC_RX_BUF_SIZE  128
+
+/** Receive ring buffer */
+static uint8_t usbcdc_rx_buf[USBCDC_RX_BUF_SIZE];
+
+/** Number of bytes received into the receive buffer, updated by handler */
+static volatile uint32_t usbcdc_rx_head;
+
+/** Number of bytes read from the receive buffer, updated by reader */
+static volatile uint32_t usbcdc_rx_tail;
+
+/**
+ * True if the data OUT endpoint is NAKing the host until the receive
+ * buffer has space for another packet
+ */
+static volatile bool usbcdc_rx_full;
+
+/**
+ * Write data to the packet memory.
+ *
+ * @param addr  Packet memory address to write to, must be even.
+ * @param ptr   Data to write.
+ * @param len   Length of the data to write, bytes.
+ */
+static void
+usbcdc_pma_write(uint16_t addr, const uint8_t *ptr, size_t len)
+{
+    volatile uint32_t *pma = USBCDC_PMA + addr / 2;
+    for (; len >= 2; len -= 2, ptr += 2) {
+        *pma++ = ptr[0] | (ptr[1] << 8);
+    }
+    if (len > 0) {
+        *pma = ptr[0];
+    }
+}
+
+/**
+ * Read data from the packet memory.
+ *
+ * @param addr  Packet memory address to read from, must be even.
+ * @param ptr   Buffer to read into.
+ * @param len   Length of the data to read, bytes.
+ */
+static void
+usbcdc_pma_read(uint16_t addr, uint8_t *ptr, size_t len)
+{
+    volatile const uint32_t *pma = USBCDC_PMA + addr / 2;
+    for (; len >= 2; len -= 2, ptr += 2) {
+        uint32_t word = *pma++;
+        ptr[0] = word;
+        ptr[1] = word >> 8;
+    }
+    if (len > 0) {
+        *ptr = *pma;
+    }
+}
+
+/**
+ * Set an endpoint's buffer descriptor table entry.
+ *
+ * @param ep        The endpoint number.
+ * @param index     Entry index: 0 - ADDR_TX, 1 - COUNT_TX,
+ *                  2 - ADDR_RX, 3 - COUNT_RX.
+ * @param value     The value to set.
+ */
+static void
+usbcdc_btable_set(unsigned int ep, unsigned int index, uint16_t value)
+{
+    USBCDC_PMA[ep * 4 + index] = value;
+}
+
+/**
+ * Get the number of bytes received by an endpoint.
+ *
+ * @param ep    The endpoint number.
+ *
+ * @return Number of bytes received.
+ */
+static size_t
+usbcdc_btable_get_count_rx(unsigned int ep)
+{
+    return USBCDC_PMA[ep * 4 + 3] & 0x3FF;
+}
+
+/**
+ * Set up an endpoint, resetting its data toggles.
+ *
+ * @param ep        The endpoint number.
+ * @param type      The endpoint type bits (USBCDC_EPR_TYPE_*).
+ * @param stat_rx   Reception status.
+ * @param stat_tx   Transmission status.
+ */
+static void
+usbcdc_ep_setup(unsigned int ep, uint32_t type,
+                enum usbcdc_stat stat_rx, enum usbcdc_stat stat_tx)
+{
+    uint32_t epr = USBCDC_REGS->epr[ep];
+    USBCDC_REGS->epr[ep] =
+        type | ep |
+        /* Toggle data toggles to zero */
+        (epr & (USBCDC_EPR_DTOG_RX | USBCDC_EPR_DTOG_TX)) |
+        /* Toggle statuses to the requested */
+        ((epr ^ (stat_rx << USBCDC_EPR_STAT_RX_LSB)) &
+            USBCDC_EPR_STAT_RX_MASK) |
+        ((epr ^ (stat_tx << USBCDC_EPR_STAT_TX_LSB)) &
+            USBCDC_EPR_STAT_TX_MASK);
+}
+
+/**
+ * Set an endpoint's transmission status.
+ *
+ * @param ep    The endpoint number.
+ * @param stat  The status to set.
+ */
+static void
+usbcdc_ep_set_stat_tx(unsigned int ep, enum usbcdc_stat stat)
+{
+    uint32_t epr = USBCDC_REGS->epr[ep];
+    USBCDC_REGS->epr[ep] =
+        (epr & USBCDC_EPR_KEEP_MASK) |
+        USBCDC_EPR_CTR_RX | USBCDC_EPR_CTR_TX |
+        ((epr ^ (stat << USBCDC_EPR_STAT_TX_LSB)) & USBCDC_EPR_STAT_TX_MASK);
+}
+
+/**
+ * Set an endpoint's reception status.
+ *
+ * @param ep    The endpoint number.
+ * @param stat  The status to set.
+ */
+static void
+usbcdc_ep_set_stat_rx(unsigned int ep, enum usbcdc_stat stat)
+{
+    uint32_t epr = USBCDC_REGS->epr[ep];
+    USBCDC_REGS->epr[ep] =
+        (epr & USBCDC_EPR_KEEP_MASK) |
+        USBCDC_EPR_CTR_RX | USBCDC_EPR_CTR_TX |
+        ((epr ^ (stat << USBCDC_EPR_STAT_RX_LSB)) & USBCDC_EPR_STAT_RX_MASK);
+}
+
+/**
+ * Clear an endpoint's "correct transfer" flags.
+ *
+ * @param ep    The endpoint number.
+ * @param mask  The flags to clear (USBCDC_EPR_CTR_RX/USBCDC_EPR_CTR_TX).
+ */
+static void
+usbcdc_ep_clear_ctr(unsigned int ep, uint32_t mask)
+{
+    uint32_t epr = USBCDC_REGS->epr[ep];
+    USBCDC_REGS->epr[ep] = (epr & USBCDC_EPR_KEEP_MASK) |
+                           ((USBCDC_EPR_CTR_RX | USBCDC_EPR_CTR_TX) & ~mask);
+}
+
+/**
+ * Transmit the next control IN packet: a piece of the pending data, or an
+ * empty packet.
+ */
+static void
+usbcdc_ctl_send(void)
+{
+    size_t len = usbcdc_ctl_len < USBCDC_PACKET_SIZE
+                    ? usbcdc_ctl_len : USBCDC_PACKET_SIZE;
+    usbcdc_pma_write(USBCDC_PMA_CTL_TX, usbcdc_ctl_ptr, len);
+    usbcdc_btable_set(USBCDC_EP_CTL, 1, len);
+    usbcdc_ctl_ptr += len;
+    usbcdc_ctl_len -= len;
+    usbcdc_ep_set_stat_tx(USBCDC_EP_CTL, USBCDC_STAT_VALID);
+}
+
+/**
+ * Start a control IN data stage.
+ *
+ * @param ptr       The data to transmit.
+ * @param len       Length of the data, bytes.
+ * @param max_len   Maximum length requested by the host, bytes.
+ */
+static void
+usbcdc_ctl_reply(const uint8_t *ptr, size_t len, size_t max_len)
+{
+    if (len > max_len) {
+        len = max_len;
+    }
+    usbcdc_ctl_ptr = ptr;
+    usbcdc_ctl_len = len;
+    /* Terminate short transfers ending on a packet boundary */
+    usbcdc_ctl_zlp = len < max_len && len % USBCDC_PACKET_SIZE == 0;
+    usbcdc_ctl_send();
+}
+
+/**
+ * Acknowledge a control request without a data stage.
+ */
+static void
+usbcdc_ctl_ack(void)
+{
+    usbcdc_ctl_reply(NULL, 0, 0);
+}
+
+/**
+ * Reject a control request.
+ */
+static void
+usbcdc_ctl_stall(void)
+{
+    usbcdc_ep_set_stat_tx(USBCDC_EP_CTL, USBCDC_STAT_STALL);
+}
+
+/**
+ * Compose a string descriptor in the control buffer.
+ *
+ * @param str   The ASCII string to compose the descriptor for.
+ *
+ * @return Length of the descriptor, bytes.
+ */
+static size_t
+usbcdc_desc_string_compose(const char *str)
+{
+    size_t len = 2;
+    for (; *str != '\0' && len < sizeof(usbcdc_ctl_buf); str++) {
+        usbcdc_ctl_buf[len++] = *str;
+        usbcdc_ctl_buf[len++] = 0;
+    }
+    usbcdc_ctl_buf[0] = len;
+    usbcdc_ctl_buf[1] = USBCDC_DESC_STRING;
+    return len;
+}
+
+/**
+ * Handle a GET_DESCRIPTOR request.
+ *
+ * @param type      Descriptor type.
+ * @param index     Descriptor index.
+ * @param max_len   Maximum length requested by the host, bytes.
+ */
+static void
+usbcdc_get_descriptor(uint8_t type, uint8_t index, size_t max_len)
+{
+    if (type == USBCDC_DESC_DEVICE) {
+        usbcdc_ctl_reply(usbcdc_desc_device,
+                         sizeof(usbcdc_desc_device), max_len);
+    } else if (type == USBCDC_DESC_CONFIGURATION) {
+        usbcdc_ctl_reply(usbcdc_desc_configuration,
+                         sizeof(usbcdc_desc_configuration), max_len);
+    } else if (type == USBCDC_DESC_STRING && index == 0) {
+        usbcdc_ctl_reply(usbcdc_desc_string_langs,
+                         sizeof(usbcdc_desc_string_langs), max_len);
+    } else if (type == USBCDC_DESC_STRING &&
+               index <= ARRAY_SIZE(usbcdc_strings)) {
+        usbcdc_ctl_reply(usbcdc_ctl_buf,
+                         usbcdc_desc_string_compose(
+                                usbcdc_strings[index - 1]),
+                         max_len);
+    } else {
+        usbcdc_ctl_stall();
+    }
+}
+
+/**
+ * Configure the data endpoints for the set configuration.
+ */
+static void
+usbcdc_configure(void)
+{
+    usbcdc_ep_setup(USBCDC_EP_DATA_IN, USBCDC_EPR_TYPE_BULK,
+                    USBCDC_STAT_DISABLED, USBCDC_STAT_NAK);
+    usbcdc_ep_setup(USBCDC_EP_DATA_OUT, USBCDC_EPR_TYPE_BULK,
+                    USBCDC_STAT_VALID, USBCDC_STAT_DISABLED);
+    usbcdc_ep_setup(USBCDC_EP_NOTIF, USBCDC_EPR_TYPE_INTR,
+                    USBCDC_STAT_DISABLED, USBCDC_STAT_NAK);
+    usbcdc_tx_busy = false;
+    usbcdc_rx_tail = usbcdc_rx_head;
+    usbcdc_rx_full = false;
+}
+
+/**
+ * Handle a SETUP packet received by the control endpoint.
+ */
+static void
+usbcdc_ctl_setup(void)
+{
+    uint8_t setup[8];
+    uint8_t type;
+    uint8_t request;
+    uint16_t value;
+    uint16_t length;
+
+    usbcdc_pma_read(USBCDC_PMA_CTL_RX, setup, sizeof(setup));
+    type = setup[0];
+    request = setup[1];
+    value = setup[2] | (setup[3] << 8);
+    length = setup[6] | (setup[7] << 8);
+
+    /* Abort whatever was in progress */
+    usbcdc_ctl_len = 0;
+    usbcdc_ctl_zlp = false;
+    usbcdc_line_coding_pending = false;
+
+    if (type == 0x80 && request == USBCDC_REQ_GET_DESCRIPTOR) {
+        usbcdc_get_descriptor(value >> 8, value & 0xFF, length);
+    } else if (type == 0x00 && request == USBCDC_REQ_SET_ADDRESS) {
+        /* Assign after the status stage */
+        usbcdc_address = value & 0x7F;
+        usbcdc_ctl_ack();
+    } else if (type == 0x00 && request == USBCDC_REQ_SET_CONFIGURATION) {
+        usbcdc_configuration = value & 0xFF;
+        if (usbcdc_configuration != 0) {
+            usbcdc_configure();
+        }
+        usbcdc_ctl_ack();
+    } else if (type == 0x80 && request == USBCDC_REQ_GET_CONFIGURATION) {
+        usbcdc_ctl_buf[0] = usbcdc_configuration;
+        usbcdc_ctl_reply(usbcdc_ctl_buf, 1, length);
+    } else if ((type & 0x9F) == 0x80 && request == USBCDC_REQ_GET_STATUS) {
+        usbcdc_ctl_buf[0] = 0;
+        usbcdc_ctl_buf[1] = 0;
+        usbcdc_ctl_reply(usbcdc_ctl_buf, 2, length);
+    } else if (type == 0xA1 && request == USBCDC_REQ_GET_LINE_CODING) {
+        usbcdc_ctl_reply(usbcdc_line_coding,
+                         sizeof(usbcdc_line_coding), length);
+    } else if (type == 0x21 && request == USBCDC_REQ_SET_LINE_CODING) {
+        /* Wait for the data stage */
+        usbcdc_line_coding_pending = true;
+    } else if (type == 0x21 &&
+               request == USBCDC_REQ_SET_CONTROL_LINE_STATE) {
+        usbcdc_dtr = value & 1;
+        usbcdc_ctl_ack();
+    } else {
+        usbcdc_ctl_stall();
+    }
+}
+
+/**
+ * Handle a transfer completed on the control endpoint.
+ */
+static void
+usbcdc_ctl_handler(void)
+{
+    uint32_t epr = USBCDC_REGS->epr[USBCDC_EP_CTL];
+
+    /* If an IN packet was sent */
+    if (epr & USBCDC_EPR_CTR_TX) {
+        usbcdc_ep_clear_ctr(USBCDC_EP_CTL, USBCDC_EPR_CTR_TX);
+        /* If an address assignment was acknowledged */
+        if (usbcdc_address != 0) {
+            USBCDC_REGS->daddr = USBCDC_DADDR_EF | usbcdc_address;
+            usbcdc_address = 0;
+        /* Else, if there's more data to send */
+        } else if (usbcdc_ctl_len > 0 || usbcdc_ctl_zlp) {
+            usbcdc_ctl_zlp = usbcdc_ctl_zlp && usbcdc_ctl_len > 0;
+            usbcdc_ctl_send();
+        }
+    }
+
+    /* If an OUT or SETUP packet was received */
+    if (epr & USBCDC_EPR_CTR_RX) {
+        usbcdc_ep_clear_ctr(USBCDC_EP_CTL, USBCDC_EPR_CTR_RX);
+        if (epr & USBCDC_EPR_SETUP) {
+            usbcdc_ctl_setup();
+        } else if (usbcdc_line_coding_pending) {
+            usbcdc_line_coding_pending = false;
+            if (usbcdc_btable_get_count_rx(USBCDC_EP_CTL) ==
+                    sizeof(usbcdc_line_coding)) {
+                usbcdc_pma_read(USBCDC_PMA_CTL_RX, usbcdc_line_coding,
+                                sizeof(usbcdc_line_coding));
+            }
+            usbcdc_ctl_ack();
+        }
+        usbcdc_ep_set_stat_rx(USBCDC_EP_CTL, USBCDC_STAT_VALID);
+    }
+}
+
+/**
+ * Send the next data IN packet from the transmit buffer, if the endpoint
+ * is free and there is data. Must be called from the handler, or with the
+ * USB interrupt masked.
+ */
+static void
+usbcdc_tx_kick(void)
+{
+    uint8_t packet[USBCDC_PACKET_SIZE];
+    uint32_t tail = usbcdc_tx_tail;
+    size_t len;
+
+    if (usbcdc_tx_busy || usbcdc_configuration == 0) {
+        return;
+    }
+
+    for (len = 0; len < sizeof(packet) && tail != usbcdc_tx_head; len++) {
+        packet[len] = usbcdc_tx_buf[tail++ & (USBCDC_TX_BUF_SIZE - 1)];
+    }
+    if (len == 0) {
+        return;
+    }
+    usbcdc_tx_tail = tail;
+
+    usbcdc_pma_write(USBCDC_PMA_DATA_IN, packet, len);
+    usbcdc_btable_set(USBCDC_EP_DATA_IN, 1, len);
+    usbcdc_tx_busy = true;
+    usbcdc_ep_set_stat_tx(USBCDC_EP_DATA_IN, USBCDC_STAT_VALID);
+}
+
+/**
+ * Move a packet received by the data OUT endpoint into the receive
+ * buffer, and accept the next one, if there is space for it. Must be
+ * called from the handler.
+ */
+static void
+usbcdc_rx_packet(void)
+{
+    uint8_t packet[USBCDC_PACKET_SIZE];
+    uint32_t head = usbcdc_rx_head;
+    size_t len = usbcdc_btable_get_count_rx(USBCDC_EP_DATA_OUT);
+    size_t i;
+
+    if (len > sizeof(packet)) {
+        len = sizeof(packet);
+    }
+    usbcdc_pma_read(USBCDC_PMA_DATA_OUT, packet, len);
+    /* The endpoint is only enabled with space for a whole packet */
+    for (i = 0; i < len; i++) {
+        usbcdc_rx_buf[head++ & (USBCDC_RX_BUF_SIZE - 1)] = packet[i];
+    }
+    usbcdc_rx_head = head;
+
+    if (USBCDC_RX_BUF_SIZE - (head - usbcdc_rx_tail) >= USBCDC_PACKET_SIZE) {
+        usbcdc_ep_set_stat_rx(USBCDC_EP_DATA_OUT, USBCDC_STAT_VALID);
+    } else {
+        usbcdc_rx_full = true;
+    }
+}
+
+/**
+ * Reset the device state and the control endpoint after a USB reset.
+ */
+static void
+usbcdc_reset(void)
+{
+    usbcdc_configuration = 0;
+    usbcdc_address = 0;
+    usbcdc_dtr = false;
+    usbcdc_ctl_len = 0;
+    usbcdc_ctl_zlp = false;
+    usbcdc_line_coding_pending = false;
+    usbcdc_tx_busy = false;
+    /* Drop whatever was queued for and received from the previous host */
+    usbcdc_tx_tail = usbcdc_tx_head;
+    usbcdc_rx_tail = usbcdc_rx_head;
+    usbcdc_rx_full = false;
+
+    /* Lay out the packet memory */
+    USBCDC_REGS->btable = 0;
+    usbcdc_btable_set(USBCDC_EP_CTL, 0, USBCDC_PMA_CTL_TX);
+    usbcdc_btable_set(USBCDC_EP_CTL, 2, USBCDC_PMA_CTL_RX);
+    usbcdc_btable_set(USBCDC_EP_CTL, 3, USBCDC_PMA_COUNT_RX_64);
+    usbcdc_btable_set(USBCDC_EP_DATA_IN, 0, USBCDC_PMA_DATA_IN);
+    usbcdc_btable_set(USBCDC_EP_DATA_OUT, 2, USBCDC_PMA_DATA_OUT);
+    usbcdc_btable_set(USBCDC_EP_DATA_OUT, 3, USBCDC_PMA_COUNT_RX_64);
+    usbcdc_btable_set(USBCDC_EP_NOTIF, 0, USBCDC_PMA_NOTIF);
+    usbcdc_btable_set(USBCDC_EP_NOTIF, 1, 0);
+
+    usbcdc_ep_setup(USBCDC_EP_CTL, USBCDC_EPR_TYPE_CONTROL,
+                    USBCDC_STAT_VALID, USBCDC_STAT_NAK);
+    /* Enable the function at address zero */
+    USBCDC_REGS->daddr = USBCDC_DADDR_EF;
+}
+
+void
+usbcdc_handler(void)
+{
+    uint32_t istr = USBCDC_REGS->istr;
+
+    if (istr & USBCDC_ISTR_RESET) {
+        USBCDC_REGS->istr = (uint16_t)~USBCDC_ISTR_RESET;
+        usbcdc_reset();
+    }
+
+    while ((istr = USBCDC_REGS->istr) & USBCDC_ISTR_CTR) {
+        unsigned int ep = istr & USBCDC_ISTR_EP_ID_MASK;
+        uint32_t epr = USBCDC_REGS->epr[ep];
+        if (ep == USBCDC_EP_CTL) {
+            usbcdc_ctl_handler();
+        } else if (ep == USBCDC_EP_DATA_IN) {
+            usbcdc_ep_clear_ctr(ep, USBCDC_EPR_CTR_TX);
+            usbcdc_tx_busy = false;
+        } else if (ep == USBCDC_EP_DATA_OUT) {
+            usbcdc_ep_clear_ctr(ep, epr & (USBCDC_EPR_CTR_RX |
+                                           USBCDC_EPR_CTR_TX));
+            if (epr & USBCDC_EPR_CTR_RX) {
+                usbcdc_rx_packet();
+            }
+        } else {
+            usbcdc_ep_clear_ctr(ep, epr & (USBCDC_EPR_CTR_RX |
+                                           USBCDC_EPR_CTR_TX));
+        }
+    }
+
+    usbcdc_tx_kick();
+}
+
+bool
+usbcdc_is_open(void)
+{
+    return usbcdc_configuration != 0 && usbcdc_dtr;
+}
+
+size_t
+usbcdc_space(void)
+{
+    return USBCDC_TX_BUF_SIZE - (usbcdc_tx_head - usbcdc_tx_tail);
+}
+
+size_t
+usbcdc_write(const void *ptr, size_t len)
+{
+    const uint8_t *p = ptr;
+    uint32_t head = usbcdc_tx_head;
+    size_t space = usbcdc_space();
+    size_t i;
+    uint32_t basepri;
+
+    if (len > space) {
+        len = space;
+    }
+    for (i = 0; i < len; i++) {
+        usbcdc_tx_buf[head++ & (USBCDC_TX_BUF_SIZE - 1)] = p[i];
+    }
+    usbcdc_tx_head = head;
+
+    /* Start sending, unless already sending */
+    basepri = irq_lock();
+    usbcdc_tx_kick();
+    irq_unlock(basepri);
+
+    return len;
+}
+
+size_t
+usbcdc_read(void *ptr, size_t len)
+{
+    uint8_t *p = ptr;
+    uint32_t tail = usbcdc_rx_tail;
+    size_t avail = usbcdc_rx_head - tail;
+    size_t i;
+    uint32_t basepri;
+
+    if (len > avail) {
+        len = avail;
+    }
+    for (i = 0; i < len; i++) {
+        p[i] = usbcdc_rx_buf[tail++ & (USBCDC_RX_BUF_SIZE - 1)];
+    }
+    usbcdc_rx_tail = tail;
+
+    /* Resume receiving, if stopped and there's space now */
+    basepri = irq_lock();
+    if (usbcdc_rx_full &&
+        USBCDC_RX_BUF_SIZE - (usbcdc_rx_head - tail) >= USBCDC_PACKET_SIZE) {
+        usbcdc_rx_full = false;
+        usbcdc_ep_set_stat_rx(USBCDC_EP_DATA_OUT, USBCDC_STAT_VALID);
+    }
+    irq_unlock(basepri);
+
+    return len;
+}
+
+void
+usbcdc_init(void)
+{
+    /* Power up the transceiver, keeping the peripheral in reset */
+    USBCDC_REGS->cntr = USBCDC_CNTR_FRES;
+    /* Wait for the transceiver to start up */
+    {
+        volatile unsigned int i;
+        /* At least 1us at 72MHz, considering 2 cycles per loop */
+        for (i = 0; i < 36; i++);
+    }
+    /* Release the reset and clear spurious interrupts */
+    USBCDC_REGS->cntr = 0;
+    USBCDC_REGS->istr = 0;
+    /* Enable the reset and transfer interrupts */
+    USBCDC_REGS->cntr = USBCDC_CNTR_CTRM | USBCDC_CNTR_RESETM;
+}
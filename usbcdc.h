@@ -0,0 +1,66 @@
+/*
+ * USB CDC ACM device, serial stream
+ */
+
+#ifndef _USBCDC_H
+#define _USBCDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Initialize the USB CDC ACM device on the USB full-speed peripheral.
+ *
+ * The USB peripheral must be fed a 48MHz clock and be reset. The
+ * usbcdc_handler() function should be arranged to be called for the USB
+ * low-priority interrupt, after usbcdc_init() completed. The caller is
+ * responsible for the D+ pull-up.
+ */
+extern void usbcdc_init(void);
+
+/**
+ * USB low-priority interrupt handler.
+ *
+ * Must be called when the USB low-priority interrupt is triggered.
+ */
+extern void usbcdc_handler(void);
+
+/**
+ * Check if the host has configured the device and opened the port,
+ * i.e. asserted DTR.
+ *
+ * @return True if the port is open.
+ */
+extern bool usbcdc_is_open(void);
+
+/**
+ * Get the free space in the transmit buffer.
+ *
+ * @return Number of bytes usbcdc_write() would accept.
+ */
+extern size_t usbcdc_space(void);
+
+/**
+ * Queue data for transmission to the host, without waiting.
+ *
+ * @param ptr   Pointer to the data to transmit.
+ * @param len   Length of the data to transmit, bytes.
+ *
+ * @return Number of bytes queued, can be less than len, if the transmit
+ *         buffer is full.
+ */
+extern size_t usbcdc_write(const void *ptr, size_t len);
+
+/**
+ * Retrieve data received from the host, without waiting. The host is
+ * held off while the receive buffer is full.
+ *
+ * @param ptr   Buffer to put the data into.
+ * @param len   Maximum length of the data to retrieve, bytes.
+ *
+ * @return Number of bytes retrieved, zero if nothing was received.
+ */
+extern size_t usbcdc_read(void *ptr, size_t len);
+
+#endif /* _USBCDC_H */
@@ -3,8 +3,13 @@
  */
 
 #include "zxprinter.h"
+#include "lines.h"
+#include "latency.h"
 #include <stddef.h>
 
+_Static_assert(ZXPRINTER_LINE_SIZE == LINES_LINE_SIZE,
+               "Captured lines don't match line slots");
+
 /** The interface's GPIO port */
 static volatile struct gpio *zxprinter_gpio = NULL;
 
@@ -43,16 +48,20 @@ static volatile struct tim *zxprinter_tim = NULL;
 #define ZXPRINTER_CYCLE_STEPS \
             (ZXPRINTER_CYCLE_AIR_STEPS + ZXPRINTER_CYCLE_PAPER_STEPS)
 
-/* Duration of a cycle of a single stylus, ms */
-#define ZXPRINTER_CYCLE_MS  48
-
-/** Stylus cycle step period, microseconds */
-#define ZXPRINTER_CYCLE_STEP_PERIOD_US \
-            (ZXPRINTER_CYCLE_MS * 1000 / ZXPRINTER_CYCLE_STEPS)
+/** Duration of the motor being off, which ends a job, ms */
+#define ZXPRINTER_JOB_GAP_MS    500
 
 /*
  * Only used by timer handler.
  */
+/** Number of timer periods the motor has been off for */
+static volatile uint32_t zxprinter_motor_off_periods;
+/** True if waiting for a free line slot */
+static bool zxprinter_stalled;
+/** Dots of the line byte being input, most significant first */
+static uint32_t zxprinter_byte;
+/** Metadata of the line being input */
+static struct linemeta zxprinter_meta;
 /** Clock step */
 static volatile uint32_t zxprinter_clock_step;
 /** Clock level */
@@ -67,7 +76,7 @@ static volatile uint32_t zxprinter_cycle_step;
  *
  * @return One if the stylus is on paper, zero otherwise.
  */
-static unsigned int
+static inline __attribute__ ((always_inline)) unsigned int
 zxprinter_cycle_is_on_paper(uint32_t step)
 {
     return step < ZXPRINTER_CYCLE_PAPER_STEPS;
@@ -80,7 +89,7 @@ zxprinter_cycle_is_on_paper(uint32_t step)
  *
  * @return One if the stylus is on the line, zero otherwise.
  */
-static unsigned int
+static inline __attribute__ ((always_inline)) unsigned int
 zxprinter_cycle_is_on_line(uint32_t step)
 {
     return step >= ZXPRINTER_CYCLE_MARGIN_STEPS &&
@@ -94,7 +103,7 @@ zxprinter_cycle_is_on_line(uint32_t step)
  *
  * @return One if the stylus cycle is done, zero otherwise.
  */
-static unsigned int
+static inline __attribute__ ((always_inline)) unsigned int
 zxprinter_cycle_is_finished(uint32_t step)
 {
     return step >= ZXPRINTER_CYCLE_STEPS;
@@ -103,21 +112,16 @@ zxprinter_cycle_is_finished(uint32_t step)
 /*
  * Read and written by timer handler, read by users.
  */
-/** Number of lines input */
-volatile uint32_t zxprinter_line_count_in;
-/*
- * Read by timer handler, read and written by users.
- */
-/** Number of lines output */
-volatile uint32_t zxprinter_line_count_out;
+/** Number of times the interface waited for a free line slot */
+volatile uint32_t zxprinter_stall_count;
 
 /*
- * Written on init, used by timer handler.
+ * Written by users, read by timer handler.
  */
-/** Line buffer */
-static volatile uint8_t *zxprinter_line_buf;
+/** Number of timer periods of the motor being off, which ends a job */
+static volatile uint32_t zxprinter_job_gap_periods;
 
-void
+RAMFUNC void
 zxprinter_tim_handler(void)
 {
     /* Read the pins */
@@ -129,6 +133,29 @@ zxprinter_tim_handler(void)
     uint32_t next_clock_step = zxprinter_clock_step + 1;
     uint32_t next_clock_level = (next_clock_step >> motor_slow) & 1U;
 
+    /* If the motor is off */
+    if (motor_off) {
+        /* If it's been off long enough to end a job */
+        if (++zxprinter_motor_off_periods >= zxprinter_job_gap_periods) {
+            zxprinter_motor_off_periods = 0;
+            /* End the job and let the other input have the lines */
+            if (lines_owner == LINES_OWNER_ZXPRINTER) {
+                lines_job_end();
+                lines_release();
+            }
+            /*
+             * Stop counting until the motor is started again. Mask all
+             * interrupts, as the WRITE handler preempting us can start
+             * the counting, and its priority is never masked by BASEPRI.
+             */
+            asm volatile ("cpsid i" ::: "memory");
+            zxprinter_tim->cr1 &= ~TIM_CR1_CEN_MASK;
+            asm volatile ("cpsie i" ::: "memory");
+        }
+    } else {
+        zxprinter_motor_off_periods = 0;
+    }
+
     /* If the clock is rising */
     if (next_clock_level > clock_level) {
         /* If the motor is not off */
@@ -152,12 +179,24 @@ zxprinter_tim_handler(void)
             next_on_paper = zxprinter_cycle_is_on_paper(next_cycle_step);
             next_on_line = zxprinter_cycle_is_on_line(next_cycle_step);
 
-            /* If we're not waiting for the line output */
-            if (!(next_on_line > on_line &&
-                  zxprinter_line_count_out < zxprinter_line_count_in)) {
-                /* Update outputs */
-                zxprinter_gpio->odr = \
-                    zxprinter_gpio->odr |
+            /*
+             * If we're waiting for the other input to finish its job, or
+             * for a free line slot
+             */
+            if (next_on_line > on_line &&
+                (!lines_claim(LINES_OWNER_ZXPRINTER) || lines_is_full())) {
+                /* Count the wait once */
+                if (!zxprinter_stalled) {
+                    zxprinter_stalled = true;
+                    zxprinter_stall_count++;
+                }
+            } else {
+                zxprinter_stalled = false;
+                /*
+                 * Update outputs, setting the pins atomically, so a
+                 * preempting WRITE resetting them isn't undone
+                 */
+                zxprinter_gpio->bsrr =
                     ((next_on_paper > on_paper) << ZXPRINTER_PIN_PAPER) |
                     (next_on_line << ZXPRINTER_PIN_ENCODER);
 
@@ -175,17 +214,22 @@ zxprinter_tim_handler(void)
         if (zxprinter_cycle_is_on_line(zxprinter_cycle_step)) {
             uint32_t dot = (zxprinter_cycle_step -
                             ZXPRINTER_CYCLE_MARGIN_STEPS);
-            uint8_t byte = dot >> 3;
-            uint8_t bit = 7 - (dot & 0x7);
-            uint8_t stylus = ((pins >> ZXPRINTER_PIN_STYLUS) & 1);
+            uint32_t stylus = ((pins >> ZXPRINTER_PIN_STYLUS) & 1);
             /* Record dot state */
-            zxprinter_line_buf[byte] =
-                (zxprinter_line_buf[byte] & ~(1 << bit)) |
-                (stylus << bit);
-            /* Signal if the line is complete */
-            if (dot + 1 >= ZXPRINTER_LINE_LEN) {
-                zxprinter_line_count_in++;
+            uint32_t byte = (zxprinter_byte << 1) | stylus;
+            /* If the byte is complete */
+            if ((dot & 0x7) == 0x7) {
+                /* Store it and account it in the line metadata */
+                lines_next()[dot >> 3] = byte;
+                linemeta_add(&zxprinter_meta, dot >> 3, byte);
+                /* Signal if the line is complete */
+                if (dot + 1 >= ZXPRINTER_LINE_LEN) {
+                    lines_put(&zxprinter_meta);
+                    linemeta_init(&zxprinter_meta);
+                }
+                byte = 0;
             }
+            zxprinter_byte = byte;
         }
         /* Advance the clock step */
         zxprinter_clock_step = next_clock_step;
@@ -201,14 +245,15 @@ zxprinter_tim_handler(void)
     zxprinter_tim->sr = 0;
 }
 
-void
+RAMFUNC void
 zxprinter_write_handler(void)
 {
     uint16_t pins;
-    /* Reset the "latches" ASAP */
-    zxprinter_gpio->odr = zxprinter_gpio->odr &
-                            ~((1U << ZXPRINTER_PIN_PAPER) |
-                              (1U << ZXPRINTER_PIN_ENCODER));
+    /* Reset the "latches" ASAP, atomically */
+    zxprinter_gpio->brr = (1U << ZXPRINTER_PIN_PAPER) |
+                          (1U << ZXPRINTER_PIN_ENCODER);
+    /* Measure how long it took */
+    latency_record();
     /* Read the pins */
     pins = zxprinter_gpio->idr;
     /* If motor is on */
@@ -221,23 +266,26 @@ zxprinter_write_handler(void)
 void
 zxprinter_init(volatile struct gpio *gpio,
                volatile struct tim *tim,
-               uint32_t ck_int,
-               volatile uint8_t *line_buf)
+               uint32_t ck_int)
 {
+    assert(lines_buf != NULL);
+
     /*
      * Initialize the variables
      */
     zxprinter_gpio = gpio;
     zxprinter_tim = tim;
-    zxprinter_line_buf = line_buf;
+    zxprinter_byte = 0;
+    linemeta_init(&zxprinter_meta);
     /* Start in the air */
     zxprinter_clock_step = 0;
     zxprinter_clock_level = 0;
     zxprinter_cycle_step = ZXPRINTER_CYCLE_STEPS;
-    /* No lines input */
-    zxprinter_line_count_in = 0;
-    /* No lines output */
-    zxprinter_line_count_out = 0;
+    /* Motor not off for any time yet */
+    zxprinter_motor_off_periods = 0;
+    /* No waits */
+    zxprinter_stalled = false;
+    zxprinter_stall_count = 0;
 
     /*
      * Setup the I/O pins
@@ -267,7 +315,7 @@ zxprinter_init(volatile struct gpio *gpio,
                          (TIM_CR1_DIR_VAL_DOWN << TIM_CR1_DIR_LSB) |
                          TIM_CR1_ARPE_MASK;
     /* Set the period */
-    zxprinter_tim->arr = ZXPRINTER_CYCLE_STEP_PERIOD_US / 2;
+    zxprinter_set_cycle_ms(ZXPRINTER_CYCLE_MS);
     /* Ask to transfer data to shadow registers */
     zxprinter_tim->egr |= TIM_EGR_UG_MASK;
     /* Enable Capture/Compare 1 interrupt */
@@ -280,3 +328,17 @@ zxprinter_init(volatile struct gpio *gpio,
     /* Signal printer interface is ready */
     gpio_pin_set(zxprinter_gpio, ZXPRINTER_PIN_READY, 1);
 }
+
+void
+zxprinter_set_cycle_ms(uint32_t ms)
+{
+    /* Stylus cycle step period, microseconds */
+    uint32_t step_period_us = ms * 1000 / ZXPRINTER_CYCLE_STEPS;
+
+    assert(ms >= ZXPRINTER_CYCLE_MS_MIN && ms <= ZXPRINTER_CYCLE_MS_MAX);
+
+    zxprinter_job_gap_periods = ZXPRINTER_JOB_GAP_MS * 1000 /
+                                (step_period_us / 2);
+    /* Preloaded, takes effect with the next period */
+    zxprinter_tim->arr = step_period_us / 2;
+}
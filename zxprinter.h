@@ -5,6 +5,7 @@
 #ifndef _ZXPRINTER_H
 #define _ZXPRINTER_H
 
+#include "ramfunc.h"
 #include <gpio.h>
 #include <tim.h>
 #include <stdint.h>
@@ -30,13 +31,40 @@ enum zxprinter_pin {
 /** Number of dots on a line */
 #define ZXPRINTER_LINE_LEN  256
 
-/** Number of lines input, updated by the interface */
-extern volatile uint32_t zxprinter_line_count_in;
-/** Number of lines output, read by the interface */
-extern volatile uint32_t zxprinter_line_count_out;
+/** Number of bytes in a line buffer */
+#define ZXPRINTER_LINE_SIZE (ZXPRINTER_LINE_LEN / 8)
 
 /**
- * Initialize the ZX Printer interface.
+ * Default duration of a cycle of a single stylus, ms, can be set by the
+ * build (48 for the original speed)
+ */
+#ifndef ZXPRINTER_CYCLE_MS
+#define ZXPRINTER_CYCLE_MS  48
+#endif
+
+/**
+ * Minimum duration of a stylus cycle settable at runtime, ms, can be set
+ * by the build. The build checks the timer handler fits a quarter of the
+ * timer period at this duration.
+ */
+#ifndef ZXPRINTER_CYCLE_MS_MIN
+#define ZXPRINTER_CYCLE_MS_MIN  (ZXPRINTER_CYCLE_MS / 2)
+#endif
+
+/** Maximum duration of a stylus cycle settable at runtime, ms */
+#define ZXPRINTER_CYCLE_MS_MAX  1000
+
+/**
+ * Number of times the interface had to wait for a free line slot, or for
+ * the other input interface to finish its job, holding up the Spectrum,
+ * updated by the interface.
+ */
+extern volatile uint32_t zxprinter_stall_count;
+
+/**
+ * Initialize the ZX Printer interface. Lines are input into the line ring
+ * buffer, which must be initialized, claiming it for each line, and
+ * releasing it at the end of each job.
  *
  * @param gpio      The GPIO port the interface is connected to.
  *                  The port should have signals assigned to pins as defined
@@ -49,27 +77,36 @@ extern volatile uint32_t zxprinter_line_count_out;
  *                  be called for the specified timer's interrupts, after
  *                  zxprinter_init() completed.
  * @param ck_int    Frequency of the clock fed to the timer (CK_INT).
- * @param line_buf  Pointer to the buffer to output input lines to.
  */
 extern void zxprinter_init(volatile struct gpio *gpio,
                            volatile struct tim *tim,
-                           uint32_t ck_int,
-                           volatile uint8_t *line_buf);
+                           uint32_t ck_int);
 
 /**
  * ZX Printer interface timer interrupt handler.
  *
  * Must be called when an interrupt is triggered for the timer passed
- * previously to zxprinter_init().
+ * previously to zxprinter_init(), at the IRQ_PRIO_ZX_ENCODER priority.
  */
-extern void zxprinter_tim_handler(void);
+extern RAMFUNC void zxprinter_tim_handler(void);
 
 /**
  * ZX Printer interface WRITE line raising handler.
  *
  * Must be called on the rising edge of the WRITE line, which is pin
- * ZXPRINTER_PIN_WRITE of the GPIO port previously passed to zxprinter_init().
+ * ZXPRINTER_PIN_WRITE of the GPIO port previously passed to zxprinter_init(),
+ * at the IRQ_PRIO_ZX_BUS priority. Records the time from the edge to the
+ * latch reset with the latency probe, if initialized.
+ */
+extern RAMFUNC void zxprinter_write_handler(void);
+
+/**
+ * Set the duration of a stylus cycle, i.e. the speed of the emulated
+ * printer. Takes effect with the next timer period.
+ *
+ * @param ms    The duration of a stylus cycle, ms, from
+ *              ZXPRINTER_CYCLE_MS_MIN to ZXPRINTER_CYCLE_MS_MAX.
  */
-extern void zxprinter_write_handler(void);
+extern void zxprinter_set_cycle_ms(uint32_t ms);
 
 #endif /* _ZXPRINTER_H */